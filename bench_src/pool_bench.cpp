@@ -0,0 +1,124 @@
+// Measures pool_template alloc and free throughput across threads,
+// printing JSON.
+//
+//  make bench
+//
+// Half of each pool is allocated up front, as it would be under load.
+// Every thread then repeatedly allocates a batch of blocks and frees them.
+// Pools are measured with and without per-thread magazines.
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "pool.hpp"
+
+namespace
+{
+    using clock_type = std::chrono::steady_clock;
+    constexpr std::size_t iterations = 1 << 20;
+    constexpr std::size_t batch_size = 4;
+    constexpr std::size_t magazine_size = 16;
+
+    using block_t = std::array<char, 64>;
+
+    class json_writer_t
+    {
+    public:
+        json_writer_t() { std::printf("{\n  \"benchmarks\": ["); }
+        ~json_writer_t() { std::printf("\n  ]\n}\n"); }
+
+        void write
+        ( std::size_t num_blocks
+        , char const* variant
+        , std::size_t num_threads
+        , double ns_per_op)
+        {
+            std::printf(
+                "%s\n    {\n"
+                "      \"name\": \"pool_template/%zu%s\",\n"
+                "      \"threads\": %zu,\n"
+                "      \"alloc_free_ns\": %.1f,\n"
+                "      \"mops_per_s\": %.1f\n"
+                "    }",
+                m_first ? "" : ",",
+                num_blocks,
+                variant,
+                num_threads,
+                ns_per_op,
+                num_threads * 1000.0 / ns_per_op);
+            m_first = false;
+        }
+
+    private:
+        bool m_first = true;
+    };
+
+    // Returns the average time one thread takes per alloc and free pair.
+    template<typename Pool>
+    double bench_pool(std::size_t num_threads)
+    {
+        auto pool = std::make_unique<Pool>();
+
+        std::vector<block_t*> held(Pool::size / 2);
+        for(block_t*& ptr : held)
+            ptr = pool->alloc();
+
+        std::vector<std::thread> threads;
+        auto const start = clock_type::now();
+        for(std::size_t t = 0; t != num_threads; ++t)
+        {
+            threads.emplace_back([&pool]()
+            {
+                std::array<block_t*, batch_size> batch;
+                for(std::size_t i = 0; i != iterations; i += batch_size)
+                {
+                    for(block_t*& ptr : batch)
+                        ptr = pool->alloc();
+                    for(block_t* ptr : batch)
+                        pool->free(ptr);
+                }
+            });
+        }
+        for(std::thread& thread : threads)
+            thread.join();
+        auto const elapsed = clock_type::now() - start;
+
+        for(block_t* ptr : held)
+            pool->free(ptr);
+
+        return std::chrono::duration<double, std::nano>(elapsed).count()
+               / iterations;
+    }
+
+    template<std::size_t NumBlocks>
+    void bench(json_writer_t& json)
+    {
+        std::size_t const max_threads
+            = std::max(4u, std::thread::hardware_concurrency());
+        for(std::size_t threads = 1; threads <= max_threads; threads *= 2)
+        {
+            using pool_t = simple_pool<block_t, NumBlocks>;
+            using cached_pool_t
+                = simple_pool<block_t, NumBlocks, magazine_size>;
+            json.write(NumBlocks, "", threads,
+                       bench_pool<pool_t>(threads));
+            json.write(NumBlocks, "/magazine", threads,
+                       bench_pool<cached_pool_t>(threads));
+        }
+    }
+}
+
+int main()
+{
+    json_writer_t json;
+
+    bench<32>(json);
+    bench<1024>(json);
+    bench<64 * 1024>(json);
+}
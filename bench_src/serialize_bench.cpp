@@ -0,0 +1,414 @@
+// Measures serialize<> encode and decode throughput, and the dispatch on
+// a variant's alternative that decoding relies on, printing JSON.
+//
+//  make bench
+//
+// Each benchmark repeats its encode and decode loops, doubling the number
+// of iterations until a run takes at least 'min_run_time'.
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <eggs/variant.hpp>
+
+#include "bit_serialize.hpp"
+#include "game.hpp"
+#include "net.hpp"
+#include "serialize.hpp"
+#include "serialize_test_types.hpp"
+#include "type_index.hpp"
+
+namespace
+{
+    using clock_type = std::chrono::steady_clock;
+    constexpr std::chrono::milliseconds min_run_time(200);
+
+    // Keeps the optimizer from discarding or hoisting benchmarked work
+    // by making it assume the pointed-to memory is read and modified.
+    inline void clobber(void const* p)
+    {
+        asm volatile("" : : "g"(p) : "memory");
+    }
+
+    template<typename F>
+    double time_ns(F f)
+    {
+        for(std::size_t iterations = 1;; iterations *= 2)
+        {
+            auto const start = clock_type::now();
+            for(std::size_t i = 0; i != iterations; ++i)
+                f();
+            auto const elapsed = clock_type::now() - start;
+            if(elapsed >= min_run_time)
+            {
+                return std::chrono::duration<double, std::nano>(elapsed)
+                       .count() / iterations;
+            }
+        }
+    }
+
+    class json_writer_t
+    {
+    public:
+        json_writer_t() { std::printf("{\n  \"benchmarks\": ["); }
+        ~json_writer_t() { std::printf("\n  ]\n}\n"); }
+
+        void write
+        ( char const* name
+        , std::size_t bytes
+        , double encode_ns
+        , double decode_ns)
+        {
+            std::printf(
+                "%s\n    {\n"
+                "      \"name\": \"%s\",\n"
+                "      \"bytes\": %zu,\n"
+                "      \"encode_ns\": %.1f,\n"
+                "      \"decode_ns\": %.1f,\n"
+                "      \"encode_mb_per_s\": %.1f,\n"
+                "      \"decode_mb_per_s\": %.1f\n"
+                "    }",
+                m_first ? "" : ",",
+                name,
+                bytes,
+                encode_ns,
+                decode_ns,
+                bytes * 1000.0 / encode_ns,
+                bytes * 1000.0 / decode_ns);
+            m_first = false;
+        }
+
+        // For timings other than an encode and decode.
+        void write(char const* name, double ns)
+        {
+            std::printf(
+                "%s\n    {\n"
+                "      \"name\": \"%s\",\n"
+                "      \"ns\": %.2f\n"
+                "    }",
+                m_first ? "" : ",",
+                name,
+                ns);
+            m_first = false;
+        }
+
+    private:
+        bool m_first = true;
+    };
+
+    template<typename S>
+    void bench(json_writer_t& json, char const* name,
+               typename S::type const& value)
+    {
+        std::vector<char> buffer(S::size(value));
+        if(S::write(value, buffer.data()) != buffer.data() + buffer.size())
+        {
+            std::fprintf(stderr, "%s: write size mismatch\n", name);
+            std::exit(EXIT_FAILURE);
+        }
+
+        double const encode_ns = time_ns([&]()
+            {
+                S::write(value, buffer.data());
+                clobber(buffer.data());
+            });
+
+        typename S::type result = value;
+        double const decode_ns = time_ns([&]()
+            {
+                S::read(buffer.data(), buffer.data() + buffer.size(),
+                        result);
+                clobber(&result);
+            });
+
+        json.write(name, buffer.size(), encode_ns, decode_ns);
+    }
+
+    // 'n' values of 'width' bits, as in a columnar run's delta column.
+    // Decoded one at a time through bit_reader, or in a batch.
+    void bench_bit_array(json_writer_t& json, char const* name,
+                         std::size_t n, unsigned width, bool batch)
+    {
+        std::vector<std::uint64_t> values(n);
+        for(std::size_t i = 0; i != n; ++i)
+            values[i] = (i * 2654435761u) & ((1u << width) - 1);
+
+        std::vector<char> buffer((n * width + 7) / 8);
+        double const encode_ns = time_ns([&]()
+            {
+                bit_writer<char*> writer(buffer.data());
+                for(std::uint64_t v : values)
+                    writer.write(v, width);
+                writer.finish();
+                clobber(buffer.data());
+            });
+
+        std::vector<std::uint64_t> result(n);
+        double const decode_ns = time_ns([&]()
+            {
+                char const* const begin = buffer.data();
+                char const* const end = begin + buffer.size();
+                std::uint64_t* out = result.data();
+                if(batch)
+                {
+                    read_bit_array(begin, end, width, n,
+                                   [&](std::uint64_t v) { *out++ = v; });
+                }
+                else
+                {
+                    bit_reader<char const*> reader(begin, end);
+                    for(std::size_t i = 0; i != n; ++i)
+                        *out++ = reader.read(width);
+                }
+                clobber(result.data());
+            });
+
+        if(result != values)
+        {
+            std::fprintf(stderr, "%s: decoded values differ\n", name);
+            std::exit(EXIT_FAILURE);
+        }
+        json.write(name, buffer.size(), encode_ns, decode_ns);
+    }
+
+    bar_t make_bar()
+    {
+        bar_t bar = {};
+        bar.foo1 = { 122, -4302, 9038414 };
+        bar.x = 1234567890123ull;
+        bar.y = true;
+        bar.foo2 = { -1, 1, 1 };
+        bar.vec = { 1, -2, 3, -4, 5, -6, 7, -8 };
+        bar.arr = { 1, 2, 3, 4, 5, 6, 7, 8 };
+        bar.v = 42;
+        return bar;
+    }
+
+    template<std::size_t I>
+    struct alt_t
+    {
+        static constexpr std::size_t value = I;
+    };
+
+    template<typename Seq>
+    struct make_variant;
+
+    template<std::size_t... Is>
+    struct make_variant<std::index_sequence<Is...>>
+    {
+        using type = eggs::variant<alt_t<Is>...>;
+    };
+
+    using variant64_t
+        = make_variant<std::make_index_sequence<64>>::type;
+
+    template<typename T>
+    struct value_of
+    {
+        std::size_t operator()(std::size_t x) const { return T::value + x; }
+    };
+
+    // The recursive if-chain that runtime_type_index_ used to be,
+    // kept as a baseline for its table.
+    template<template<typename> class FuncObj, typename... Ts>
+    struct chain_index_;
+
+    template<template<typename> class FuncObj, typename T, typename... Ts>
+    struct chain_index_<FuncObj, T, Ts...>
+    {
+        template<typename... Args>
+        [[gnu::always_inline]]
+        static auto func(std::size_t index, Args&&... args)
+        {
+            if(index == 0)
+            {
+                FuncObj<T> func;
+                return func(std::forward<Args>(args)...);
+            }
+            return chain_index_<FuncObj, Ts...>::func(
+                index - 1,
+                std::forward<Args>(args)...);
+        }
+    };
+
+    template<template<typename> class FuncObj>
+    struct chain_index_<FuncObj>
+    {
+        template<typename... Args>
+        [[gnu::always_inline]]
+        static auto func(std::size_t index, Args&&... args)
+        -> decltype(FuncObj<void>()(args...))
+        {
+            throw std::out_of_range("runtime_type_index out of range ");
+        }
+    };
+
+    template<typename V>
+    struct chain_indexer;
+
+    template<typename... Ts>
+    struct chain_indexer<eggs::variant<Ts...>>
+    {
+        template<template<typename> class FuncObj, typename... Args>
+        auto operator()(std::size_t index, Args&&... args) const
+        {
+            return chain_index_<FuncObj, Ts...>::func(
+                index,
+                std::forward<Args>(args)...);
+        }
+    };
+
+    // Nanoseconds per dispatch on each of 'indices' in turn.
+    template<typename Indexer>
+    double time_dispatch_ns(std::vector<std::size_t> const& indices)
+    {
+        Indexer indexer;
+        std::size_t sum = 0;
+        double const ns = time_ns([&]()
+            {
+                for(std::size_t index : indices)
+                {
+                    sum += indexer.template operator()<value_of>(
+                        index, sum & 1);
+                }
+                clobber(&sum);
+            });
+        return ns / indices.size();
+    }
+
+    // 64 alternatives, dispatched on at random or always on the last.
+    void bench_dispatch(json_writer_t& json)
+    {
+        std::size_t const n = 1 << 16;
+        std::mt19937 rng(0);
+        std::uniform_int_distribution<std::size_t> dist(0, 63);
+
+        std::vector<std::size_t> random(n);
+        for(std::size_t& index : random)
+            index = dist(rng);
+        std::vector<std::size_t> const last(n, 63);
+
+        using table_t = runtime_type_indexer<variant64_t>;
+        using chain_t = chain_indexer<variant64_t>;
+
+        json.write("runtime_type_index/table/random",
+                   time_dispatch_ns<table_t>(random));
+        json.write("runtime_type_index/if_chain/random",
+                   time_dispatch_ns<chain_t>(random));
+        json.write("runtime_type_index/table/last",
+                   time_dispatch_ns<table_t>(last));
+        json.write("runtime_type_index/if_chain/last",
+                   time_dispatch_ns<chain_t>(last));
+    }
+
+    // Copied in bulk from a vector, and an element at a time from a deque.
+    std::vector<std::int32_t> make_ints(std::size_t n)
+    {
+        std::vector<std::int32_t> ints(n);
+        std::iota(ints.begin(), ints.end(), 0);
+        return ints;
+    }
+
+    diff_t make_diff(std::size_t num_updates)
+    {
+        diff_t diff = { 1000, {} };
+        for(std::size_t i = 0; i != num_updates; ++i)
+        {
+            object_id_t const id = i;
+            coord_t const position = { int(i % 255), int(i / 255 % 255) };
+            switch(i % 4)
+            {
+            case 0:
+                diff.updates.push_back(
+                    update_create_object_t{ id, position });
+                break;
+            case 1:
+                diff.updates.push_back(update_destroy_object_t{ id });
+                break;
+            case 2:
+                diff.updates.push_back(
+                    update_object_position_t{ id, position });
+                break;
+            default:
+                diff.updates.push_back(
+                    update_create_player_t{ player_id_t(i % 64), id });
+                break;
+            }
+        }
+        return diff;
+    }
+
+    // A tick in which many objects moved.
+    update_list_t make_position_updates(std::size_t num_updates)
+    {
+        update_list_t updates;
+        for(std::size_t i = 0; i != num_updates; ++i)
+        {
+            object_id_t const id = i * 3;
+            coord_t const position = { int(i % 255), int(i / 255 % 255) };
+            updates.push_back(update_object_position_t{ id, position });
+        }
+        return updates;
+    }
+
+    // One object per tile.
+    game_state_t::serialized_t make_game_state(int w, int h)
+    {
+        game_state_t::serialized_t state;
+        state.dimen = { w, h };
+        for(int y = 0; y != h; ++y)
+        for(int x = 0; x != w; ++x)
+        {
+            object_id_t const id = state.objects.size() + 1;
+            state.objects.push_back({ id, { x, y } });
+        }
+        for(player_id_t id = 1; id <= 64; ++id)
+            state.players.push_back({ id, object_id_t(id) });
+        return state;
+    }
+}
+
+int main()
+{
+    json_writer_t json;
+
+    bench<serialize<foo_t>>(json, "foo_t", { 122, -4302, 9038414 });
+    bench<serialize<bar_t>>(json, "bar_t", make_bar());
+    bench<serialize<diff_t>>(json, "diff_t/10000", make_diff(10000));
+    std::vector<std::int32_t> const ints = make_ints(4096);
+    bench<serialize<std::vector<std::int32_t>>>(
+        json, "vector<int32_t>/4096", ints);
+    bench<serialize<std::deque<std::int32_t>>>(
+        json, "deque<int32_t>/4096", { ints.begin(), ints.end() });
+    bench<serialize<update_list_t, varint>>(
+        json, "update_list_t/rows/1000", make_position_updates(1000));
+    bench<serialize<update_list_t, columnar>>(
+        json, "update_list_t/columnar/1000", make_position_updates(1000));
+    bench_bit_array(json, "bit_array/bit_reader/1000x5", 1000, 5, false);
+    bench_bit_array(json, "bit_array/batch/1000x5", 1000, 5, true);
+    bench<serialize<game_state_t::serialized_t>>(
+        json, "game_state_t::serialized_t/256x256",
+        make_game_state(256, 256));
+
+    bench<serialize<cts_tcp_login_t>>(
+        json, "cts_tcp_login_t", { std::string(32, 'u') });
+
+    bench<serialize<cts_udp_message_t, bit_packed>>(
+        json, "cts_udp_message_t",
+        { { 1234, 5678 }, { CTS_INPUT_RIGHT } });
+    bench<serialize<stc_udp_header_t, bit_packed>>(
+        json, "stc_udp_header_t", { 4321, 3, 1234 });
+    bench<serialize<stc_udp_message_body_t, bit_packed>>(
+        json, "stc_udp_message_body_t", { 7 });
+
+    bench_dispatch(json);
+}
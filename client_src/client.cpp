@@ -2,14 +2,18 @@
 
 client_t::client_t
 ( asio::io_service& io_service
+, client_game_t& game
 , std::string const& address
 , std::string const& port)
 : m_io_service(io_service)
+, m_game(game)
 , m_tcp_socket(io_service)
 , m_tcp_socket_strand(io_service)
+, m_tcp_parser()
 , m_udp_socket(io_service)
 , m_udp_socket_strand(io_service)
 , m_udp_pool(new udp_pool_t())
+, m_udp_send_pool(new udp_send_pool_t())
 {
     m_tcp_socket.open(ip::tcp::v6());
     ip::tcp::resolver tcp_resolver(m_io_service);
@@ -92,17 +96,17 @@ void client_t::handle_udp_receive
 {
     udp_receiver_t& receiver = *shared_receiver;
     auto it = receiver.buffer.cbegin();
-    auto const end = receiver.buffer.cend() + bytes_received;
+    auto const end = receiver.buffer.cbegin() + bytes_received;
 
     stc_udp_header_t header;
-    it = serialize<stc_udp_header_t>::read(it, end, header);
+    it = serialize<stc_udp_header_t, bit_packed>::read(it, end, header);
 
     // Check for duplicate packets. This can return false negatives.
     if(update_queue.has(header.time))
         return;
 
-    stc_udp_message_body_t body;
-    it = serialize<stc_udp_message_body_t>::read(it, end, body);
+    // The rest of the datagram is the server's update list.
+    m_game.read_updates(it, end);
 }
 
 void client_t::attempt_join()
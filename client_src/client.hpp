@@ -12,11 +12,14 @@
 #include <boost/asio.hpp>
 
 #include "buffer.hpp"
+#include "buffer_sequence.hpp"
+#include "client_game.hpp"
 #include "game.hpp"
 #include "net.hpp"
 #include "pool.hpp"
 #include "safe_strand.hpp"
 #include "serialize.hpp"
+#include "stream_parser.hpp"
 #include "threadsafe_queue.hpp"
 
 namespace asio = boost::asio;
@@ -38,13 +41,27 @@ public:
         udp_buffer_t buffer;
     };
 
-    static constexpr std::size_t udp_pool_size = 32;
+    // Receivers are often freed by a different io thread than the one
+    // which allocated them, so each thread caches a magazine of them.
+    static constexpr std::size_t udp_pool_size = 128;
+    static constexpr std::size_t udp_magazine_size = 8;
     using shared_udp_receiver_t = shared_pooled_ptr<udp_receiver_t, 
-                                                    udp_pool_size>;
+                                                    udp_pool_size,
+                                                    udp_magazine_size>;
     using udp_pool_t = shared_udp_receiver_t::pool_type;
 
+    // Storage for outgoing messages with a small max_size, which would
+    // otherwise each allocate a shared_buffer_t.
+    static constexpr std::size_t udp_send_buffer_size = 64;
+    using udp_send_buffer_t = std::array<char, udp_send_buffer_size>;
+    using shared_udp_send_buffer_t = shared_pooled_ptr<udp_send_buffer_t,
+                                                       udp_pool_size,
+                                                       udp_magazine_size>;
+    using udp_send_pool_t = shared_udp_send_buffer_t::pool_type;
+
     client_t
     ( asio::io_service& io_service
+    , client_game_t& game
     , std::string const& address
     , std::string const& port);
   
@@ -86,27 +103,17 @@ private:
     , cts_tcp_message_t message
     , Handler handler);
 
-    template<typename Handler>
-    void tcp_read
-    ( tcp_socket_key_t key
-    , std::size_t bytes
-    , Handler handler);
-
+    // Calls 'handler' with the next message, reading from the socket
+    // only when no complete message has been buffered already.
     template<typename Handler>
     void tcp_read_message
     ( tcp_socket_key_t key
     , Handler handler);
 
-    template<typename Handler>
-    void tcp_read_message_body
-    ( tcp_socket_key_t key
-    , stc_tcp_header_t header
-    , Handler handler);
-
-    template<typename Handler>
+    template<typename Buffers, typename Handler>
     void udp_send
     ( udp_socket_key_t key
-    , shared_buffer_t shared_buffer
+    , Buffers buffers
     , Handler handler);
 
     template<typename Handler>
@@ -138,14 +145,18 @@ private:
     
 private:
     asio::io_service& m_io_service;
+    client_game_t& m_game;
 
     ip::tcp::socket m_tcp_socket;
     safe_strand<tcp_socket_tag> m_tcp_socket_strand;
+    // Only accessed while holding a tcp_socket_key_t.
+    stream_parser<stc_tcp_header_t, stc_tcp_message_t> m_tcp_parser;
 
     ip::udp::socket m_udp_socket;
     ip::udp::endpoint m_udp_endpoint;
     safe_strand<udp_socket_tag> m_udp_socket_strand;
     std::unique_ptr<udp_pool_t> m_udp_pool;
+    std::unique_ptr<udp_send_pool_t> m_udp_send_pool;
 
     std::atomic<std::uint32_t> m_sequence_number;
 
@@ -229,115 +240,51 @@ void client_t::tcp_send_message
 , cts_tcp_message_t message
 , Handler handler)
 {
-    using header_serialize = serialize<cts_tcp_header_t>;
-    using message_serialize = serialize<cts_tcp_message_t, void>;
-
-    cts_tcp_header_t header = 
-    {
-        message.which(),
-        message_serialize::size(message),
-    };
-
-    shared_buffer_t shared_buffer(
-        header_serialize::size(header)
-        + message_serialize::size(message));
-
-    auto it = header_serialize::write(header, shared_buffer.begin());
-    it = message_serialize::write(message, it);
+    shared_buffer_t shared_buffer
+        = serialize_tcp_message<cts_tcp_header_t>(message);
 
     tcp_send(std::move(key), std::move(shared_buffer), handler);
 }
 
 template<typename Handler>
-void client_t::tcp_read
+void client_t::tcp_read_message
 ( tcp_socket_key_t key
-, std::size_t bytes
 , Handler handler)
 {
-    shared_buffer_t shared_buffer(bytes);
-    auto asio_buffer = asio::buffer(
-        shared_buffer.data(), 
-        shared_buffer.size());
+    stc_tcp_message_t message;
+    if(m_tcp_parser.next(message))
+    {
+        handler(std::move(key), std::move(message));
+        return;
+    }
 
-    asio::async_read(
-        m_tcp_socket,
+    constexpr std::size_t read_size = 4096;
+    char* const ptr = m_tcp_parser.prepare(read_size);
+    auto asio_buffer = asio::buffer(ptr, m_tcp_parser.prepared_size());
+
+    m_tcp_socket.async_read_some(
         asio_buffer,
         m_tcp_socket_strand.wrap(
-            [this, shared_buffer = std::move(shared_buffer), handler]
-            (tcp_socket_key_t key, error_code_t const& e, std::size_t) mutable
+            [this, handler]
+            (tcp_socket_key_t key, error_code_t const& e, std::size_t bytes)
             {
                 if(e)
                     throw system_error(e);
-                handler(std::move(key), std::move(shared_buffer));
+                m_tcp_parser.commit(bytes);
+                tcp_read_message(std::move(key), handler);
             }));
 }
 
-template<typename Handler>
-void client_t::tcp_read_message
-( tcp_socket_key_t key
-, Handler handler)
-{
-    // First read the header:
-    using header_serialize = serialize<stc_tcp_header_t>;
-    tcp_read(
-        std::move(key),
-        header_serialize::const_size,
-        [this, handler](tcp_socket_key_t key, shared_buffer_t shared_buffer)
-        {
-            stc_tcp_header_t header;
-            header_serialize::read(
-                shared_buffer.begin(),
-                shared_buffer.end(),
-                header);
-
-            // Then read the message body:
-            tcp_read_message_body(
-                std::move(key),
-                std::move(header),
-                handler);
-        });
-}
-
-template<typename Handler>
-void client_t::tcp_read_message_body
-( tcp_socket_key_t key
-, stc_tcp_header_t header
-, Handler handler)
-{
-    tcp_read(
-        std::move(key),
-        header.payload_size,
-        [this, header, handler]
-        (tcp_socket_key_t key, shared_buffer_t shared_buffer)
-        {
-            stc_tcp_message_t message;
-            
-            using vs = variant_serializer<stc_tcp_message_t>;
-            runtime_type_indexer<stc_tcp_message_t> indexer;
-            indexer.operator()<vs::reader>(
-                header.opcode,
-                shared_buffer.begin(),
-                shared_buffer.end(),
-                &message);
-
-            handler(std::move(key), std::move(message));
-        });
-}
-
-template<typename Handler>
+template<typename Buffers, typename Handler>
 void client_t::udp_send
 ( udp_socket_key_t key
-, shared_buffer_t shared_buffer
+, Buffers buffers
 , Handler handler)
 {
-    std::printf("sending %lu\n", shared_buffer.size());
-
-    auto asio_buffer = asio::buffer(shared_buffer.data(),
-                                    shared_buffer.size());
     m_udp_socket.async_send_to(
-        asio_buffer,
+        buffers,
         m_udp_endpoint,
-        [this, shared_buffer = std::move(shared_buffer), handler]
+        [this, buffers, handler]
         (error_code_t const& e, std::size_t) mutable
         {
             if(e)
@@ -352,10 +299,25 @@ void client_t::udp_send_message
 , cts_udp_message_t message
 , Handler handler)
 {
-    using serialize_t = serialize<cts_udp_message_t>;
-    shared_buffer_t shared_buffer(serialize_t::size(message));
-    serialize_t::write(message, shared_buffer.begin());
-    udp_send(std::move(key), std::move(shared_buffer), handler);
+    using serialize_t = serialize<cts_udp_message_t, bit_packed>;
+    if constexpr(serialize_fits<udp_send_buffer_size, serialize_t>::value)
+    {
+        shared_udp_send_buffer_t storage
+            = make_shared_from_pool(*m_udp_send_pool);
+        std::size_t const size
+            = serialize_t::write(message, storage->data()) - storage->data();
+        udp_send(std::move(key),
+                 pooled_buffer_t(std::move(storage), size),
+                 handler);
+    }
+    else
+    {
+        buffer_sink_t sink;
+        serialize_t::write(message, sink.out());
+        udp_send(std::move(key),
+                 shared_buffer_sequence_t<1>(sink.release()),
+                 handler);
+    }
 }
 
 /*
@@ -1,40 +1,77 @@
 #ifndef CLIENT_GAME_HPP
 #define CLIENT_GAME_HPP
 
+#include <array>
+#include <mutex>
+#include <optional>
+
+#include "arena.hpp"
+#include "game.hpp"
+#include "serialize.hpp"
+
 class client_game_t
 {
 public:
+    explicit client_game_t(dimen_t dimen) : m_game_state(dimen) {}
 
     // Thread-safe. Can be called by multiple threads concurrently.
     template<typename It>
     void enqueue_updates(It begin, It end)
     {
         std::unique_lock<std::mutex> lock(m_update_queue_mutex);
+        update_list_t& queue = *m_queues[m_back].updates;
         for(It it = begin; it != end; ++it)
-            m_update_queue.push_back(*it);
+            queue.push_back(*it);
+    }
+
+    // Thread-safe. Decodes a serialized update list from a packet
+    // straight onto the end of the queue, in the queue's arena.
+    // Nothing is queued if the list is malformed.
+    template<typename It>
+    It read_updates(It begin, It end)
+    {
+        std::unique_lock<std::mutex> lock(m_update_queue_mutex);
+        return serialize<update_list_t, columnar>::append(
+            begin, end, *m_queues[m_back].updates);
     }
 
     // Not thread-safe.
+    // Producers switch to the other queue while this one is applied,
+    // then its arena is released in one go.
     void dequeue_updates()
     {
-        std::deque<update_t> updates;
+        update_queue_t* front;
         {
             std::unique_lock<std::mutex> lock(m_update_queue_mutex);
-            updates.swap(m_update_queue);
+            front = &m_queues[m_back];
+            m_back ^= 1;
         }
 
-        for(update_t const& update : updates)
+        for(update_t const& update : *front->updates)
         {
             eggs::variants::apply(
                 [&](auto update) { m_game_state.apply_update(update); },
-                m_game_state);
+                update);
         }
+
+        front->updates.reset();
+        front->arena.reset();
+        front->updates.emplace(front->arena.resource());
     }
 
 private:
+    struct update_queue_t
+    {
+        update_queue_t() { updates.emplace(arena.resource()); }
+
+        arena_t arena;
+        std::optional<update_list_t> updates;
+    };
+
     game_state_t m_game_state;
 
-    std::deque<update_t> m_update_queue;
+    std::array<update_queue_t, 2> m_queues;
+    std::size_t m_back = 0;
     mutable std::mutex m_update_queue_mutex;
 };
 
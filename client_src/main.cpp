@@ -8,7 +8,7 @@
 #include <SFML/Graphics.hpp>
 
 #include "client.hpp"
-//#include "client_game.hpp"
+#include "client_game.hpp"
 #include "game.hpp"
 
 namespace asio = boost::asio;
@@ -56,14 +56,13 @@ int main(int argc, char* argv[])
 
     asio::io_service io_service;
 
-    //client_game_t client_game;
+    client_game_t client_game(dimen_t{ 256, 256 });
     game_state_t game_state(dimen_t{ 256, 256 });
 
     object_t o(1, { 3, 3 });
     game_state.add_object(o);
 
-    //client c(client_game, argv[1], argv[2]);
-    client_t client(io_service, argv[1], argv[2]);
+    client_t client(io_service, client_game, argv[1], argv[2]);
 
     std::thread net_thread(
         [&client]()
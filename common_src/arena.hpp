@@ -0,0 +1,57 @@
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+// A monotonic arena for short-lived objects, such as the updates decoded
+// from one network tick. Allocation bumps a pointer, deallocation does
+// nothing, and reset() releases everything at once.
+//
+// Containers use the arena through std::pmr allocators. Reads keep the
+// destination's allocator, so decoding into a container constructed on
+// the arena allocates nothing from the heap:
+//
+//  arena_t arena;
+//  diff_t diff = { 0, update_list_t(arena.resource()) };
+//  serialize<diff_t>::read(begin, end, diff);
+//  ...
+//  diff = {};     // Destroy everything using the arena first.
+//  arena.reset();
+//
+// The first 'initial_size' bytes are allocated once and reused after
+// every reset. Beyond that the arena grows from the heap until reset.
+// Not thread-safe.
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+
+class arena_t
+{
+public:
+    explicit arena_t(std::size_t initial_size = 64 * 1024,
+                     std::pmr::memory_resource* upstream
+                         = std::pmr::get_default_resource())
+    : m_initial(new char[initial_size])
+    , m_resource(m_initial.get(), initial_size, upstream)
+    {}
+
+    arena_t(arena_t const&) = delete;
+    arena_t& operator=(arena_t const&) = delete;
+
+    std::pmr::memory_resource* resource() { return &m_resource; }
+
+    template<typename T>
+    std::pmr::polymorphic_allocator<T> allocator()
+    {
+        return std::pmr::polymorphic_allocator<T>(&m_resource);
+    }
+
+    // Frees everything allocated from the arena. Objects using it must
+    // be destroyed first.
+    void reset() { m_resource.release(); }
+
+private:
+    std::unique_ptr<char[]> m_initial;
+    std::pmr::monotonic_buffer_resource m_resource;
+};
+
+#endif
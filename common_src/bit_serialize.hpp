@@ -0,0 +1,590 @@
+#ifndef BIT_SERIALIZE_HPP
+#define BIT_SERIALIZE_HPP
+
+// Bit-granular serialization, for packing small fields of UDP messages
+// tighter than whole bytes allow.
+//
+// Members opt in by passing bits<N> as their parameter:
+//
+//  struct foo
+//  {
+//      SERIALIZED_DATA
+//      (
+//          ((cts_input_t)   (input)  (bits<3>))
+//          ((std::int16_t)  (dx)     (bits<5>))
+//          ((std::uint16_t) (seq)    ())
+//      )
+//  };
+//
+// serialize<foo, bit_packed> then writes 3 + 5 + 16 bits, padded to a
+// whole number of bytes. Members without a bits<N> parameter take their
+// usual number of bytes * 8, and bools take 1 bit. Integer parameters
+// such as (std::uint8_t) work as usual, but others, like varint, don't
+// compile when bit packed.
+// Bits are packed least significant first, matching the byte order.
+//
+// When serialized byte-aligned (without bit_packed), bits<N> is stored
+// in the smallest integer type that can hold N bits, but values which
+// don't fit in N bits are rejected either way.
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#include "serialize_impl.hpp"
+
+template<unsigned N>
+struct bits
+{
+    static_assert(N > 0 && N <= 64, "bits<N> must be between 1 and 64");
+};
+
+struct bit_packed {};
+
+namespace serialize_impl
+{
+    inline std::uint64_t low_bits_mask(unsigned n)
+    {
+        return n >= 64 ? ~std::uint64_t(0) : (std::uint64_t(1) << n) - 1;
+    }
+}
+
+template<typename OutputIt>
+class bit_writer
+{
+public:
+    explicit bit_writer(OutputIt it) : m_it(it), m_acc(0), m_count(0) {}
+
+    // Writes the low 'n' bits of 'value'.
+    void write(std::uint64_t value, unsigned n)
+    {
+        assert(n <= 64);
+        if(n > 32)
+        {
+            write32(value & 0xFFFFFFFF, 32);
+            value >>= 32;
+            n -= 32;
+        }
+        write32(value, n);
+    }
+
+    // Pads the final partial byte with zeroes and returns the end iterator.
+    OutputIt finish()
+    {
+        for(; m_count; m_count -= std::min(m_count, 8u), m_acc >>= 8, ++m_it)
+            *m_it = static_cast<char>(m_acc & 0xFF);
+        m_acc = 0;
+        return m_it;
+    }
+
+private:
+    // Writes at most 32 bits. Kept apart from 'write' so that neither
+    // is recursive, and both can be inlined.
+    void write32(std::uint64_t value, unsigned n)
+    {
+        // Bytes are written 4 at a time, so that the number written
+        // doesn't depend on 'n' and the branch is predictable. Members are
+        // copied to locals because the bytes written may alias them.
+        std::uint64_t acc
+            = m_acc | (value & serialize_impl::low_bits_mask(n)) << m_count;
+        unsigned count = m_count + n;
+        if(count >= 32)
+        {
+            m_it = serialize_impl::write_little_endian(
+                static_cast<std::uint32_t>(acc), m_it);
+            acc >>= 32;
+            count -= 32;
+        }
+        m_acc = acc;
+        m_count = count;
+    }
+
+    OutputIt m_it;
+    std::uint64_t m_acc;
+    unsigned m_count;
+};
+
+template<typename InputIt>
+class bit_reader
+{
+public:
+    bit_reader(InputIt begin, InputIt end)
+    : m_it(begin)
+    , m_end(end)
+    , m_acc(0)
+    , m_count(0)
+    {}
+
+    std::uint64_t read(unsigned n)
+    {
+        assert(n <= 64);
+        if(n > 32)
+        {
+            std::uint64_t const lo = read32(32);
+            return lo | (read32(n - 32) << 32);
+        }
+        return read32(n);
+    }
+
+    // Returns an iterator past the last byte read from.
+    // Unread bits of that byte are padding, and are skipped.
+    InputIt position() const { return m_it; }
+
+private:
+    std::uint64_t read32(unsigned n)
+    {
+        for(; m_count < n; m_count += 8, ++m_it)
+        {
+            if(m_it == m_end)
+                throw std::range_error("serialize::read range too small");
+            m_acc |= std::uint64_t(static_cast<unsigned char>(*m_it))
+                     << m_count;
+        }
+
+        std::uint64_t const value = m_acc & serialize_impl::low_bits_mask(n);
+        m_acc >>= n;
+        m_count -= n;
+        return value;
+    }
+
+    InputIt m_it;
+    InputIt m_end;
+    std::uint64_t m_acc;
+    unsigned m_count;
+};
+
+namespace serialize_impl
+{
+    // Eight W-bit values fill exactly W bytes. With W known at compile
+    // time each one is a load, shift and mask at a constant offset, which
+    // the compiler schedules together instead of one after another.
+    template<unsigned W, std::size_t... J>
+    void unpack_group(char const* data, std::uint64_t* out,
+                      std::index_sequence<J...>)
+    {
+        constexpr std::uint64_t mask = (std::uint64_t(1) << W) - 1;
+        std::uint64_t word[8];
+        (load_endian<true>(data + J * W / 8, word[J]), ...);
+        ((out[J] = word[J] >> (J * W % 8) & mask), ...);
+    }
+
+    template<unsigned W>
+    void unpack_groups(char const* data, std::size_t groups,
+                       std::uint64_t* out)
+    {
+        for(std::size_t g = 0; g != groups; ++g, data += W, out += 8)
+            unpack_group<W>(data, out, std::make_index_sequence<8>());
+    }
+
+    template<std::size_t... W>
+    void unpack_groups(unsigned width, char const* data, std::size_t groups,
+                       std::uint64_t* out, std::index_sequence<W...>)
+    {
+        using unpack_t = void(*)(char const*, std::size_t, std::uint64_t*);
+        static constexpr unpack_t table[] = { &unpack_groups<W + 1>... };
+        table[width - 1](data, groups, out);
+    }
+}
+
+// Reads 'n' values of 'width' bits each, as written one after the other
+// by a bit_writer, and calls f with each in order. Returns an iterator
+// past the last byte read from, like bit_reader::position.
+//
+// Contiguous input is unpacked without a loop per byte: values are taken
+// eight at a time by code specialized for their width, and the input is
+// bounds checked once up front.
+template<typename InputIt, typename F>
+InputIt read_bit_array(InputIt const begin, InputIt const end,
+                       unsigned width, std::size_t n, F&& f)
+{
+    assert(width != 0 && width <= 64);
+    if(n == 0)
+        return begin;
+
+    constexpr unsigned max_load_width = 64 - 7;
+    if constexpr(serialize_impl::is_contiguous_bytes<InputIt>::value)
+    {
+        std::size_t const size = std::distance(begin, end);
+        if(n > size / width * 8 + size % width * 8 / width)
+            throw std::range_error("serialize::read range too small");
+        if(width <= max_load_width)
+        {
+            std::size_t const bytes = (n * width + 7) / 8;
+            char const* const data = &*begin;
+            std::uint64_t const mask = serialize_impl::low_bits_mask(width);
+
+            // Whole groups of eight whose loads all lie within the input,
+            // unpacked a chunk at a time.
+            std::size_t const groups
+                = std::min(n / 8, bytes >= width + 8
+                                  ? (bytes - 8) / width : 0);
+            constexpr std::size_t chunk_groups = 8;
+            std::array<std::uint64_t, chunk_groups * 8> chunk;
+            for(std::size_t g = 0; g != groups;)
+            {
+                std::size_t const count
+                    = std::min(groups - g, chunk_groups);
+                serialize_impl::unpack_groups(
+                    width, data + g * width, count, chunk.data(),
+                    std::make_index_sequence<max_load_width>());
+                for(std::size_t j = 0; j != count * 8; ++j)
+                    f(chunk[j]);
+                g += count;
+            }
+
+            // Then single values whose 8 bytes lie within the input.
+            std::size_t i = groups * 8;
+            std::size_t bit = i * width;
+            for(; i != n && bit / 8 + 8 <= bytes; ++i, bit += width)
+            {
+                std::uint64_t word;
+                serialize_impl::read_little_endian(data + bit / 8, word);
+                f((word >> (bit % 8)) & mask);
+            }
+
+            // The last few, through a copy padded with zeroes.
+            if(i != n)
+            {
+                std::size_t const offset = bit / 8;
+                std::array<char, 16> tail = {};
+                std::copy(data + offset, data + bytes, tail.data());
+                for(bit %= 8; i != n; ++i, bit += width)
+                {
+                    std::uint64_t word;
+                    serialize_impl::read_little_endian(
+                        tail.data() + bit / 8, word);
+                    f((word >> (bit % 8)) & mask);
+                }
+            }
+            return std::next(begin, bytes);
+        }
+    }
+
+    bit_reader<InputIt> reader(begin, end);
+    for(std::size_t i = 0; i != n; ++i)
+        f(reader.read(width));
+    return reader.position();
+}
+
+// A bit_writer which only counts, used to size non-const_size structs.
+class bit_counter
+{
+public:
+    void write(std::uint64_t, unsigned n) { m_count += n; }
+    std::size_t count() const { return m_count; }
+private:
+    std::size_t m_count = 0;
+};
+
+namespace serialize_impl
+{
+    template<typename To, typename From>
+    constexpr bool in_range(From v)
+    {
+        using to_limits = std::numeric_limits<To>;
+        if constexpr(std::is_signed<From>::value
+                     && !std::is_signed<To>::value)
+        {
+            return (v >= 0
+                    && std::uintmax_t(v) <= std::uintmax_t(to_limits::max()));
+        }
+        else if constexpr(!std::is_signed<From>::value
+                          && std::is_signed<To>::value)
+        {
+            return std::uintmax_t(v) <= std::uintmax_t(to_limits::max());
+        }
+        else
+        {
+            using common = std::common_type_t<To, From>;
+            return (common(v) >= common(to_limits::min())
+                    && common(v) <= common(to_limits::max()));
+        }
+    }
+
+    template<unsigned N, bool Signed>
+    using least_int_t = std::conditional_t<Signed,
+        std::conditional_t<(N <= 8), std::int8_t,
+        std::conditional_t<(N <= 16), std::int16_t,
+        std::conditional_t<(N <= 32), std::int32_t, std::int64_t>>>,
+        std::conditional_t<(N <= 8), std::uint8_t,
+        std::conditional_t<(N <= 16), std::uint16_t,
+        std::conditional_t<(N <= 32), std::uint32_t, std::uint64_t>>>>;
+
+    template<typename T>
+    constexpr unsigned bit_width = std::is_same<T, bool>::value
+                                   ? 1 : sizeof(T) * 8;
+
+    // Stores a T whose value has the range of Underlying in 'Bits' bits.
+    // Signed values use two's complement.
+    template<typename T, typename Underlying, bool Signed, unsigned Bits>
+    struct int_bit_serialize
+    {
+        using type = T;
+        using wide = std::conditional_t<Signed, std::intmax_t,
+                                        std::uintmax_t>;
+
+        static constexpr std::size_t const_bits = Bits;
+
+        static constexpr wide max = (Signed
+            ? wide((std::uintmax_t(1) << (Bits - 1)) - 1)
+            : wide(~std::uintmax_t(0) >> (64 - Bits)));
+        static constexpr wide min = Signed ? -max - 1 : 0;
+
+        // True if 'u' can be stored in Bits bits.
+        static bool fits(Underlying u)
+        {
+            return in_range<wide>(u) && wide(u) >= min && wide(u) <= max;
+        }
+
+        template<typename Reader>
+        static void read(Reader& reader, T& dest)
+        {
+            std::uintmax_t raw = reader.read(Bits);
+            wide v;
+            if(Signed && Bits < 64 && (raw >> (Bits - 1)))
+                v = wide(raw | ~low_bits_mask(Bits));
+            else
+                v = wide(raw);
+
+            if(!in_range<Underlying>(v))
+                throw std::overflow_error("serialize::read overflow");
+            dest = static_cast<T>(v);
+        }
+
+        template<typename Writer>
+        static void write(T const& src, Writer& writer)
+        {
+            Underlying const u = static_cast<Underlying>(src);
+            if(!fits(u))
+                throw std::overflow_error("serialize::write overflow");
+            writer.write(std::uintmax_t(wide(u)), Bits);
+        }
+    };
+
+    template<typename T, typename... P>
+    struct bit_serialize;
+
+    template<typename S>
+    struct to_bit_serialize;
+
+    template<typename T, typename... P>
+    struct to_bit_serialize<serialize<T, P...>>
+    {
+        using type = bit_serialize<T, P...>;
+    };
+
+    template<typename M, typename = void>
+    struct bit_members_size_ {};
+
+    template<typename... Ms>
+    struct bit_members_size_<std::tuple<Ms...>, std::void_t<
+        decltype((to_bit_serialize<Ms>::type::const_bits + ... + 0))>>
+    {
+        static constexpr std::size_t const_bits
+            = (to_bit_serialize<Ms>::type::const_bits + ... + 0);
+    };
+
+    template<typename T, typename = void>
+    struct bit_members_size {};
+
+    template<typename T>
+    struct bit_members_size<T, std::void_t<typename T::serialized_members>>
+    : bit_members_size_<typename T::serialized_members>
+    {};
+
+    template<typename T, bool IsIntegral, bool IsEnum, typename... P>
+    struct bit_base_;
+
+    template<typename T>
+    struct bit_base_<T, false, false>
+    : bit_members_size<T>
+    {
+        template<typename Reader>
+        static void read(Reader& reader, T& dest)
+        {
+            dest.read_serialized_bits(reader);
+        }
+
+        template<typename Writer>
+        static void write(T const& src, Writer& writer)
+        {
+            src.write_serialized_bits(writer);
+        }
+    };
+
+    template<typename T>
+    struct bit_base_<T, true, false>
+    : int_bit_serialize<T, T, std::is_signed<T>::value, bit_width<T>>
+    {};
+
+    // Integer parameters set the width. Others, such as varint, have no
+    // bit packed form, and would otherwise be taken as a byte wide.
+    template<typename T, typename Int>
+    struct bit_base_<T, true, false, Int>
+    : int_bit_serialize<T, T, std::is_signed<Int>::value, bit_width<Int>>
+    {
+        static_assert(std::is_integral<Int>::value,
+                      "bit_packed integers take an integer or bits<N>");
+    };
+
+    template<typename T, unsigned N>
+    struct bit_base_<T, true, false, bits<N>>
+    : int_bit_serialize<T, T, std::is_signed<T>::value, N>
+    {};
+
+    template<typename T>
+    struct bit_base_<T, false, true>
+    : int_bit_serialize<T, std::underlying_type_t<T>,
+                        std::is_signed<std::underlying_type_t<T>>::value,
+                        bit_width<std::underlying_type_t<T>>>
+    {};
+
+    template<typename T, typename Int>
+    struct bit_base_<T, false, true, Int>
+    : int_bit_serialize<T, std::underlying_type_t<T>,
+                        std::is_signed<Int>::value, bit_width<Int>>
+    {
+        static_assert(std::is_integral<Int>::value,
+                      "bit_packed enums take an integer or bits<N>");
+    };
+
+    template<typename T, unsigned N>
+    struct bit_base_<T, false, true, bits<N>>
+    : int_bit_serialize<T, std::underlying_type_t<T>,
+                        std::is_signed<std::underlying_type_t<T>>::value, N>
+    {};
+
+    template<typename T, typename... P>
+    struct bit_serialize
+    : bit_base_<T, std::is_integral<T>::value, std::is_enum<T>::value, P...>
+    {
+        static std::size_t bit_size(T const& t)
+        {
+            bit_counter counter;
+            bit_serialize::write(t, counter);
+            return counter.count();
+        }
+    };
+
+    // Called through function templates so that structs which are never
+    // bit packed don't instantiate their members' bit_serialize.
+    template<typename S, typename Reader, typename T>
+    void read_bits(Reader& reader, T& dest)
+    {
+        to_bit_serialize<S>::type::read(reader, dest);
+    }
+
+    template<typename S, typename Writer, typename T>
+    void write_bits(T const& src, Writer& writer)
+    {
+        to_bit_serialize<S>::type::write(src, writer);
+    }
+
+    template<typename B, typename = void>
+    struct bit_packed_size
+    {
+        template<typename T>
+        static std::size_t size(T const& t)
+        {
+            return (B::bit_size(t) + 7) / 8;
+        }
+    };
+
+    template<typename B>
+    struct bit_packed_size<B, std::void_t<decltype(B::const_bits)>>
+    {
+        static constexpr std::size_t const_size = (B::const_bits + 7) / 8;
+
+        template<typename T>
+        static std::size_t size(T const&)
+        {
+            return const_size;
+        }
+    };
+
+    // Byte-aligned bits<N>, stored in the smallest integer type that can
+    // hold N bits. Values are still limited to N bits, so that a struct
+    // accepts the same values whether or not it's bit packed.
+    template<typename T, typename Underlying, bool Signed, unsigned Bits>
+    struct bits_int_serialize
+    : int_serialize<T, Underlying, least_int_t<Bits, Signed>>
+    {
+        using int_base = int_serialize<T, Underlying,
+                                       least_int_t<Bits, Signed>>;
+        using bit_base = int_bit_serialize<T, Underlying, Signed, Bits>;
+
+        template<typename It>
+        static It read(It const begin, It const end, T& dest)
+        {
+            check_range(begin, end, int_base::const_size);
+            return read_unchecked(begin, dest);
+        }
+
+        template<typename It>
+        static It read_unchecked(It const begin, T& dest)
+        {
+            T t;
+            It const it = int_base::read_unchecked(begin, t);
+            if(!bit_base::fits(static_cast<Underlying>(t)))
+                throw std::overflow_error("serialize::read overflow");
+            dest = t;
+            return it;
+        }
+
+        template<typename It>
+        static It write(T const& src, It const dest)
+        {
+            if(!bit_base::fits(static_cast<Underlying>(src)))
+                throw std::overflow_error("serialize::write overflow");
+            return int_base::write(src, dest);
+        }
+    };
+
+    template<typename T, unsigned N>
+    struct base_<T, true, false, false, bits<N>>
+    : bits_int_serialize<T, T, std::is_signed<T>::value, N>
+    {};
+
+    template<typename T, unsigned N>
+    struct base_<T, false, true, false, bits<N>>
+    : bits_int_serialize<T, std::underlying_type_t<T>,
+        std::is_signed<std::underlying_type_t<T>>::value, N>
+    {};
+
+    template<typename T>
+    struct base_<T, false, false, false, bit_packed>
+    : bit_packed_size<bit_serialize<T>>
+    {
+        using type = T;
+
+        template<typename It>
+        static It read(It const begin, It const end, T& dest)
+        {
+            bit_reader<It> reader(begin, end);
+            bit_serialize<T>::read(reader, dest);
+            return reader.position();
+        }
+
+        template<typename It>
+        static It read_unchecked(It const begin, T& dest)
+        {
+            return read(begin, std::next(begin, base_::const_size), dest);
+        }
+
+        template<typename It>
+        static It write(T const& src, It const dest)
+        {
+            bit_writer<It> writer(dest);
+            bit_serialize<T>::write(src, writer);
+            return writer.finish();
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,155 @@
+#ifndef BOUNDED_SINK_HPP
+#define BOUNDED_SINK_HPP
+
+// Serializes into a fixed-size buffer, such as a udp_buffer_t, without
+// measuring first. Writes that don't fit are reported instead of
+// overflowing the buffer, and leave the sink as it was:
+//
+//  udp_buffer_t buffer;
+//  bounded_sink_t sink(buffer);
+//  sink.try_write<serialize<stc_udp_header_t, bit_packed>>(header);
+//  auto rest = sink.try_write_list<serialize<update_list_t, columnar>>(
+//      updates.begin(), updates.end());
+//  // The updates in [rest, end) go in the next datagram.
+//
+// Bounded serializers (see serialize_max_size) are written straight
+// into the buffer whenever their max_size fits. Anything else is written
+// through a bounded_output_iterator, which checks every byte.
+
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+
+#include "serialize.hpp"
+
+// An output iterator over [begin, end) which drops bytes past the end.
+// Serializers return a copy of the iterator they were given, so the
+// result of serialize<T>::write tells whether the write was truncated.
+class bounded_output_iterator
+{
+public:
+    using iterator_category = std::output_iterator_tag;
+    using value_type = void;
+    using difference_type = std::ptrdiff_t;
+    using pointer = void;
+    using reference = void;
+
+    bounded_output_iterator(char* begin, char* end)
+    : m_ptr(begin)
+    , m_end(end)
+    , m_truncated(false)
+    {}
+
+    bounded_output_iterator& operator=(char c)
+    {
+        if(m_ptr != m_end)
+            *m_ptr++ = c;
+        else
+            m_truncated = true;
+        return *this;
+    }
+
+    bounded_output_iterator& operator*() { return *this; }
+    bounded_output_iterator& operator++() { return *this; }
+    bounded_output_iterator operator++(int) { return *this; }
+
+    // Appends 'n' bytes at once, or none of them if they don't fit.
+    bounded_output_iterator append(void const* src, std::size_t n)
+    {
+        if(std::size_t(m_end - m_ptr) < n)
+            m_truncated = true;
+        else if(n)
+        {
+            std::memcpy(m_ptr, src, n);
+            m_ptr += n;
+        }
+        return *this;
+    }
+
+    // Where the next byte would go. Only meaningful when not truncated.
+    char* base() const { return m_ptr; }
+    bool truncated() const { return m_truncated; }
+
+private:
+    char* m_ptr;
+    char* m_end;
+    bool m_truncated;
+};
+
+class bounded_sink_t
+{
+public:
+    bounded_sink_t(char* begin, char* end)
+    : m_begin(begin)
+    , m_ptr(begin)
+    , m_end(end)
+    , m_truncated(false)
+    {}
+
+    template<std::size_t N>
+    explicit bounded_sink_t(std::array<char, N>& buffer)
+    : bounded_sink_t(buffer.data(), buffer.data() + N)
+    {}
+
+    char* data() const { return m_begin; }
+    std::size_t size() const { return m_ptr - m_begin; }
+    std::size_t capacity() const { return m_end - m_begin; }
+    std::size_t remaining() const { return m_end - m_ptr; }
+
+    // True once any try_write hasn't fit.
+    bool truncated() const { return m_truncated; }
+
+    // Writes t using the serializer S and returns true, or returns false
+    // and writes nothing if t doesn't fit in the remaining space. Bytes
+    // past size() may be overwritten either way.
+    template<typename S, typename T>
+    bool try_write(T const& t)
+    {
+        if constexpr(serialize_impl::is_bounded<S>::value)
+        {
+            if(serialize_impl::max_size<S>() <= remaining())
+            {
+                m_ptr = S::write(t, m_ptr);
+                return true;
+            }
+        }
+
+        bounded_output_iterator it(m_ptr, m_end);
+        it = S::write(t, it);
+        if(it.truncated())
+        {
+            m_truncated = true;
+            return false;
+        }
+        m_ptr = it.base();
+        return true;
+    }
+
+    // Writes as many elements from [begin, end) as fit, in order, as a
+    // list readable by the list serializer L, and returns the first
+    // element not written. L must provide 'max_prefix', as
+    // serialize<update_list_t, columnar> does.
+    // Throws std::length_error if not even an empty list fits.
+    template<typename L, typename It>
+    It try_write_list(It const begin, It const end)
+    {
+        if(remaining() < L::min_size)
+            throw std::length_error("bounded_sink_t: list doesn't fit");
+
+        It const prefix_end = L::max_prefix(begin, end, remaining());
+        m_ptr = L::write(begin, prefix_end, m_ptr);
+        if(prefix_end != end)
+            m_truncated = true;
+        return prefix_end;
+    }
+
+private:
+    char* m_begin;
+    char* m_ptr;
+    char* m_end;
+    bool m_truncated;
+};
+
+#endif
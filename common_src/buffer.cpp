@@ -0,0 +1,324 @@
+#include "buffer.hpp"
+
+#include <algorithm>
+#include <mutex>
+#include <new>
+#include <vector>
+
+// Each size class has a shared free list, protected by a mutex, and each
+// thread caches free blocks of every class in front of it. Allocating and
+// freeing only touch the calling thread's cache, and blocks move to and
+// from the shared list batch_size at a time. Statistics are counted per
+// thread too, and summed by buffer_stats().
+
+namespace buffer_impl
+{
+    namespace
+    {
+        // Size classes past the last are allocated from the heap.
+        constexpr std::uint32_t heap_size_class = num_size_classes;
+
+        // Slabs hold at least this many bytes, or a single block.
+        constexpr std::size_t min_slab_size = 64 * 1024;
+
+        // Each thread caches up to twice this many free blocks per class.
+        constexpr std::size_t batch_size = 16;
+
+        // Free blocks are linked through their own storage.
+        struct free_block_t
+        {
+            free_block_t* next;
+        };
+
+        struct free_list_t
+        {
+            free_block_t* head = nullptr;
+            std::size_t count = 0;
+
+            void push(void* storage)
+            {
+                head = new(storage) free_block_t{ head };
+                ++count;
+            }
+
+            void* pop()
+            {
+                free_block_t* const block = head;
+                head = block->next;
+                --count;
+                block->~free_block_t();
+                return block;
+            }
+        };
+
+        class size_class_t
+        {
+        public:
+            // Moves batch_size free blocks to 'list', adding slabs first
+            // if there aren't enough.
+            void refill(std::uint32_t size_class, free_list_t& list)
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                while(m_free.count < batch_size)
+                    add_slab(size_class);
+                for(std::size_t i = 0; i != batch_size; ++i)
+                    list.push(m_free.pop());
+            }
+
+            void* allocate(std::uint32_t size_class)
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if(!m_free.count)
+                    add_slab(size_class);
+                return m_free.pop();
+            }
+
+            void deallocate(void* storage) noexcept
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_free.push(storage);
+            }
+
+            // Moves 'n' free blocks from 'list'.
+            void drain(free_list_t& list, std::size_t n) noexcept
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                for(std::size_t i = 0; i != n; ++i)
+                    m_free.push(list.pop());
+            }
+
+            std::size_t reserved()
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                return m_reserved;
+            }
+
+        private:
+            void add_slab(std::uint32_t size_class)
+            {
+                std::size_t const block_size
+                    = sizeof(block_header_t)
+                      + (min_slab_buffer_size << size_class);
+                std::size_t const num_blocks
+                    = std::max<std::size_t>(min_slab_size / block_size, 1);
+
+                m_slabs.emplace_back(new char[block_size * num_blocks]);
+                char* const slab = m_slabs.back().get();
+                for(std::size_t i = num_blocks; i != 0; --i)
+                    m_free.push(slab + (i - 1) * block_size);
+                m_reserved += num_blocks;
+            }
+
+            std::mutex m_mutex;
+            free_list_t m_free;
+            std::vector<std::unique_ptr<char[]>> m_slabs;
+            std::size_t m_reserved = 0;
+        };
+
+        // Written only by the owning thread, so increments needn't be
+        // atomic read-modify-writes. Atomic so that buffer_stats() can
+        // read them.
+        class counter_t
+        {
+        public:
+            void increment()
+            {
+                m_value.store(m_value.load(std::memory_order_relaxed) + 1,
+                              std::memory_order_relaxed);
+            }
+
+            std::size_t get() const
+            {
+                return m_value.load(std::memory_order_relaxed);
+            }
+
+        private:
+            std::atomic<std::size_t> m_value{0};
+        };
+
+        // Indexed by size class, with the heap last.
+        using counts_t = std::array<std::size_t, num_size_classes + 1>;
+        using counters_t = std::array<counter_t, num_size_classes + 1>;
+
+        struct local_cache_t;
+
+        // Never destroyed, so that buffers may outlive static destruction.
+        struct globals_t
+        {
+            std::array<size_class_t, num_size_classes> size_classes;
+
+            std::mutex mutex;
+            std::vector<local_cache_t*> caches;
+
+            // Counts from threads which have exited.
+            counts_t allocations = {};
+            counts_t deallocations = {};
+        };
+
+        globals_t& globals()
+        {
+            static globals_t* const globals = new globals_t();
+            return *globals;
+        }
+
+        // Set once the calling thread's local_cache has been destroyed.
+        // Buffers freed after that, such as by static destructors, use the
+        // shared free lists directly.
+        thread_local bool local_cache_destroyed = false;
+
+        // The calling thread's free blocks and counters.
+        // Its free blocks are returned when the thread exits.
+        struct local_cache_t
+        {
+            local_cache_t()
+            {
+                globals_t& g = globals();
+                std::lock_guard<std::mutex> lock(g.mutex);
+                g.caches.push_back(this);
+            }
+
+            ~local_cache_t()
+            {
+                globals_t& g = globals();
+                for(std::size_t i = 0; i != num_size_classes; ++i)
+                    if(lists[i].count)
+                        g.size_classes[i].drain(lists[i], lists[i].count);
+
+                std::lock_guard<std::mutex> lock(g.mutex);
+                for(std::size_t i = 0; i != num_size_classes + 1; ++i)
+                {
+                    g.allocations[i] += allocations[i].get();
+                    g.deallocations[i] += deallocations[i].get();
+                }
+                g.caches.erase(std::find(g.caches.begin(), g.caches.end(),
+                                         this));
+                local_cache_destroyed = true;
+            }
+
+            std::array<free_list_t, num_size_classes> lists;
+            counters_t allocations;
+            counters_t deallocations;
+        };
+
+        thread_local local_cache_t local_cache;
+
+        void count_allocation(std::uint32_t size_class)
+        {
+            if(!local_cache_destroyed)
+                local_cache.allocations[size_class].increment();
+            else
+            {
+                globals_t& g = globals();
+                std::lock_guard<std::mutex> lock(g.mutex);
+                ++g.allocations[size_class];
+            }
+        }
+
+        void count_deallocation(std::uint32_t size_class)
+        {
+            if(!local_cache_destroyed)
+                local_cache.deallocations[size_class].increment();
+            else
+            {
+                globals_t& g = globals();
+                std::lock_guard<std::mutex> lock(g.mutex);
+                ++g.deallocations[size_class];
+            }
+        }
+
+        std::uint32_t size_class_of(std::size_t size)
+        {
+            std::uint32_t size_class = 0;
+            while(size_class != heap_size_class
+                  && (min_slab_buffer_size << size_class) < size)
+            {
+                ++size_class;
+            }
+            return size_class;
+        }
+    }
+
+    block_header_t* allocate(std::size_t size)
+    {
+        std::uint32_t const size_class = size_class_of(size);
+
+        void* storage;
+        if(size_class == heap_size_class)
+            storage = ::operator new(sizeof(block_header_t) + size);
+        else if(local_cache_destroyed)
+            storage = globals().size_classes[size_class].allocate(size_class);
+        else
+        {
+            free_list_t& list = local_cache.lists[size_class];
+            if(!list.head)
+                globals().size_classes[size_class].refill(size_class, list);
+            storage = list.pop();
+        }
+        count_allocation(size_class);
+
+        block_header_t* const header = new(storage) block_header_t;
+        header->refcount.store(1, std::memory_order_relaxed);
+        header->size_class = size_class;
+        return header;
+    }
+
+    void deallocate(block_header_t* header) noexcept
+    {
+        std::uint32_t const size_class = header->size_class;
+
+        header->~block_header_t();
+        if(size_class == heap_size_class)
+            ::operator delete(header);
+        else if(local_cache_destroyed)
+            globals().size_classes[size_class].deallocate(header);
+        else
+        {
+            free_list_t& list = local_cache.lists[size_class];
+            list.push(header);
+            if(list.count == 2 * batch_size)
+                globals().size_classes[size_class].drain(list, batch_size);
+        }
+        count_deallocation(size_class);
+    }
+}
+
+buffer_stats_t buffer_stats()
+{
+    using namespace buffer_impl;
+    globals_t& g = globals();
+
+    counts_t allocations;
+    counts_t deallocations;
+    {
+        std::lock_guard<std::mutex> lock(g.mutex);
+        allocations = g.allocations;
+        deallocations = g.deallocations;
+        for(local_cache_t const* cache : g.caches)
+        {
+            for(std::size_t i = 0; i != num_size_classes + 1; ++i)
+            {
+                allocations[i] += cache->allocations[i].get();
+                deallocations[i] += cache->deallocations[i].get();
+            }
+        }
+    }
+
+    // Counters from different threads are read at slightly different
+    // times, so a buffer's free may be counted without its allocation.
+    auto const in_use = [&](std::size_t i)
+    {
+        return allocations[i] - std::min(allocations[i], deallocations[i]);
+    };
+
+    buffer_stats_t stats;
+    for(std::uint32_t i = 0; i != num_size_classes; ++i)
+    {
+        stats.size_classes[i] = { min_slab_buffer_size << i,
+                                  g.size_classes[i].reserved(),
+                                  in_use(i),
+                                  allocations[i] };
+    }
+    stats.heap_in_use = in_use(heap_size_class);
+    stats.heap_allocations = allocations[heap_size_class];
+    return stats;
+}
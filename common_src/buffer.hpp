@@ -1,29 +1,139 @@
 #ifndef BUFFER_HPP
 #define BUFFER_HPP
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
 #include <memory>
+#include <stdexcept>
+
+#include <boost/asio/buffer.hpp>
+#include <boost/iterator/iterator_adaptor.hpp>
+
+// shared_buffer_t storage. Buffers of up to max_slab_buffer_size bytes
+// are carved from slabs, in power-of-two size classes starting at
+// min_slab_buffer_size, and reused once freed. Larger buffers come from
+// the heap. Either way, the reference count is stored in a header just
+// before the bytes, so each buffer is a single allocation.
+// See buffer.cpp.
+namespace buffer_impl
+{
+    constexpr std::size_t min_slab_buffer_size = 64;
+    constexpr std::size_t num_size_classes = 11;
+    constexpr std::size_t max_slab_buffer_size
+        = min_slab_buffer_size << (num_size_classes - 1);
+
+    struct alignas(16) block_header_t
+    {
+        std::atomic<std::uint32_t> refcount;
+        std::uint32_t size_class;
+
+        char* data() { return reinterpret_cast<char*>(this + 1); }
+    };
+
+    // Thread-safe. Returns a block with a refcount of 1.
+    block_header_t* allocate(std::size_t size);
+    void deallocate(block_header_t* block) noexcept;
+}
+
+// A snapshot of shared_buffer_t allocations, from buffer_stats().
+struct buffer_stats_t
+{
+    struct size_class_t
+    {
+        std::size_t buffer_size; // The largest buffer in this class.
+        std::size_t reserved;    // Buffers carved from slabs so far.
+        std::size_t in_use;
+        std::size_t allocations; // Since the program started.
+    };
+
+    std::array<size_class_t, buffer_impl::num_size_classes> size_classes;
+
+    // Buffers larger than max_slab_buffer_size.
+    std::size_t heap_in_use;
+    std::size_t heap_allocations;
+};
+
+// Thread-safe.
+buffer_stats_t buffer_stats();
 
 // A buffer with an immutable size.
-// Uses shared_ptr internally and has same thread safety rules as shared_ptr.
+// Reference counted, with the same thread safety rules as shared_ptr.
 // Copies like a shared_ptr too.
+//
+// A buffer may be a slice of a larger one, sharing its storage. One large
+// read can be split into messages, or one encoding can be sent in parts,
+// without copying:
+//
+//  shared_buffer_t header = packet.slice(0, header_size);
+//  shared_buffer_t body = packet.slice(header_size, body_size);
 class shared_buffer_t
 {
 public:
+    class view_iterator;
+
+    // Constructs an empty buffer without allocating.
+    shared_buffer_t()
+    : m_block(nullptr)
+    , m_begin_ptr(nullptr)
+    , m_end_ptr(nullptr)
+    {}
+
     explicit shared_buffer_t(std::size_t size)
-    : m_data(new char[size], std::default_delete<char[]>())
-    , m_end_ptr(m_data.get() + size)
+    : m_block(buffer_impl::allocate(size))
+    , m_begin_ptr(m_block->data())
+    , m_end_ptr(m_begin_ptr + size)
     {}
 
-    shared_buffer_t(shared_buffer_t const&) = default;
-    shared_buffer_t(shared_buffer_t&&) = default;
+    shared_buffer_t(shared_buffer_t const& o) noexcept
+    : m_block(o.m_block)
+    , m_begin_ptr(o.m_begin_ptr)
+    , m_end_ptr(o.m_end_ptr)
+    {
+        if(m_block)
+            m_block->refcount.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    shared_buffer_t(shared_buffer_t&& o) noexcept
+    : m_block(o.m_block)
+    , m_begin_ptr(o.m_begin_ptr)
+    , m_end_ptr(o.m_end_ptr)
+    {
+        o.m_block = nullptr;
+        o.m_begin_ptr = nullptr;
+        o.m_end_ptr = nullptr;
+    }
+
+    ~shared_buffer_t()
+    {
+        if(m_block 
+           && m_block->refcount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            buffer_impl::deallocate(m_block);
+        }
+    }
+
+    shared_buffer_t& operator=(shared_buffer_t const& o) noexcept
+    {
+        shared_buffer_t copy(o);
+        swap(*this, copy);
+        return *this;
+    }
 
-    shared_buffer_t& operator=(shared_buffer_t const&) = default;
-    shared_buffer_t& operator=(shared_buffer_t&&) = default;
+    shared_buffer_t& operator=(shared_buffer_t&& o) noexcept
+    {
+        shared_buffer_t moved(std::move(o));
+        swap(*this, moved);
+        return *this;
+    }
 
     friend void swap(shared_buffer_t&, shared_buffer_t&);
 
-    char const* data() const { return m_data.get(); }
-    char* data() { return m_data.get(); }
+    char const* data() const { return m_begin_ptr; }
+    char* data() { return m_begin_ptr; }
     
     char const& operator[](std::size_t i) const { return data()[i]; }
     char& operator[](std::size_t i) { return data()[i]; }
@@ -41,11 +151,158 @@ public:
     const_iterator end() const { return m_end_ptr; }
     iterator end() { return m_end_ptr; }
 
+    // Returns the 'size' bytes starting at 'offset', sharing this buffer's
+    // storage. Throws std::out_of_range unless they're all in the buffer.
+    shared_buffer_t slice(std::size_t offset, std::size_t size) const
+    {
+        if(offset > this->size() || size > this->size() - offset)
+            throw std::out_of_range("shared_buffer_t::slice");
+        shared_buffer_t slice(*this);
+        slice.m_begin_ptr += offset;
+        slice.m_end_ptr = slice.m_begin_ptr + size;
+        return slice;
+    }
+
+    // The asio buffer doesn't keep the storage alive; keep a copy of the
+    // shared_buffer_t until asio is done with it.
+    explicit operator boost::asio::const_buffer() const
+    {
+        return boost::asio::const_buffer(data(), size());
+    }
+
+    // Iterators which remember the buffer they point into.
+    // Deserializing views (see shared_view.hpp) requires these.
+    view_iterator view_begin() const;
+    view_iterator view_end() const;
+
 private:
-    std::shared_ptr<char> m_data;
+    friend class buffer_sink_t;
+
+    buffer_impl::block_header_t* m_block;
+    char* m_begin_ptr;
     char* m_end_ptr;
 };
 
+class shared_buffer_t::view_iterator
+: public boost::iterator_adaptor<view_iterator, char const*>
+{
+public:
+    view_iterator() : view_iterator::iterator_adaptor_(), m_buffer(nullptr) {}
+
+    view_iterator(shared_buffer_t const& buffer, char const* ptr)
+    : view_iterator::iterator_adaptor_(ptr)
+    , m_buffer(&buffer)
+    {}
+
+    shared_buffer_t const& buffer() const { return *m_buffer; }
+
+private:
+    shared_buffer_t const* m_buffer;
+};
+
+inline auto shared_buffer_t::view_begin() const -> view_iterator
+{
+    return view_iterator(*this, begin());
+}
+
+inline auto shared_buffer_t::view_end() const -> view_iterator
+{
+    return view_iterator(*this, end());
+}
+
+// Builds a shared_buffer_t whose final size isn't known in advance.
+// Bytes are appended through an output iterator, and the storage doubles
+// whenever it runs out, so serializing into a sink takes a single pass:
+//
+//  buffer_sink_t sink;
+//  serialize<T>::write(t, sink.out());
+//  shared_buffer_t buffer = sink.release();
+class buffer_sink_t
+{
+public:
+    class iterator
+    {
+    public:
+        using iterator_category = std::output_iterator_tag;
+        using value_type = void;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = void;
+
+        explicit iterator(buffer_sink_t& sink) : m_sink(&sink) {}
+
+        iterator& operator=(char c)
+        {
+            m_sink->push_back(c);
+            return *this;
+        }
+
+        iterator& operator*() { return *this; }
+        iterator& operator++() { return *this; }
+        iterator operator++(int) { return *this; }
+
+        // Appends 'n' bytes at once.
+        iterator append(void const* src, std::size_t n)
+        {
+            m_sink->append(src, n);
+            return *this;
+        }
+
+    private:
+        buffer_sink_t* m_sink;
+    };
+
+    explicit buffer_sink_t(std::size_t capacity = 256)
+    : m_buffer(std::max<std::size_t>(capacity, 1))
+    , m_size(0)
+    {}
+
+    iterator out() { return iterator(*this); }
+
+    char* data() { return m_buffer.data(); }
+    char const* data() const { return m_buffer.data(); }
+    std::size_t size() const { return m_size; }
+    std::size_t capacity() const { return m_buffer.size(); }
+
+    void push_back(char c)
+    {
+        if(m_size == m_buffer.size())
+            grow(m_size + 1);
+        m_buffer[m_size++] = c;
+    }
+
+    void append(void const* src, std::size_t n)
+    {
+        if(m_buffer.size() - m_size < n)
+            grow(m_size + n);
+        if(n)
+            std::memcpy(m_buffer.data() + m_size, src, n);
+        m_size += n;
+    }
+
+    // Returns the bytes written so far without copying them, and leaves the
+    // sink empty. The returned buffer's size is the number of bytes written.
+    shared_buffer_t release()
+    {
+        shared_buffer_t buffer = std::move(m_buffer);
+        buffer.m_end_ptr = buffer.data() + m_size;
+        m_buffer = shared_buffer_t();
+        m_size = 0;
+        return buffer;
+    }
+
+private:
+    void grow(std::size_t min_capacity)
+    {
+        shared_buffer_t buffer(std::max(min_capacity, m_buffer.size() * 2));
+        std::copy(m_buffer.data(), m_buffer.data() + m_size, buffer.data());
+        m_buffer = std::move(buffer);
+    }
+
+    shared_buffer_t m_buffer;
+    std::size_t m_size;
+};
+
 // A buffer with an immutable size, based on std::unique_ptr.
 class unique_buffer_t
 {
@@ -90,7 +347,8 @@ private:
 inline void swap(shared_buffer_t& a, shared_buffer_t& b)
 {
     using std::swap;
-    swap(a.m_data, b.m_data);
+    swap(a.m_block, b.m_block);
+    swap(a.m_begin_ptr, b.m_begin_ptr);
     swap(a.m_end_ptr, b.m_end_ptr);
 }
 
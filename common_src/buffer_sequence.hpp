@@ -0,0 +1,122 @@
+#ifndef BUFFER_SEQUENCE_HPP
+#define BUFFER_SEQUENCE_HPP
+
+#include <array>
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
+#include <boost/asio/buffer.hpp>
+
+#include "buffer.hpp"
+
+// Several shared_buffer_t segments sent as one message, without first
+// copying them into a single buffer. Models asio's ConstBufferSequence,
+// so it can be passed to async_write and async_send_to directly:
+//
+//  shared_buffer_sequence_t buffers(header, shared_body);
+//  asio::async_write(socket, buffers, handler);
+//
+// Copies share the segments, which stay alive as long as any copy does.
+template<std::size_t N>
+class shared_buffer_sequence_t
+{
+public:
+    using value_type = boost::asio::const_buffer;
+    using const_iterator = value_type const*;
+
+    // Constrained so that copying a non-const sequence isn't taken as
+    // constructing a sequence out of it.
+    template<typename... Buffers, typename = std::enable_if_t<
+        (std::is_convertible<Buffers, shared_buffer_t>::value && ...)>>
+    explicit shared_buffer_sequence_t(Buffers&&... buffers)
+    : m_buffers{{ std::forward<Buffers>(buffers)... }}
+    , m_asio_buffers()
+    {
+        static_assert(sizeof...(Buffers) == N, "wrong number of segments");
+        for(std::size_t i = 0; i != N; ++i)
+        {
+            m_asio_buffers[i] = boost::asio::const_buffer(m_buffers[i]);
+        }
+    }
+
+    const_iterator begin() const { return m_asio_buffers.data(); }
+    const_iterator end() const { return m_asio_buffers.data() + N; }
+
+    shared_buffer_t const& segment(std::size_t i) const
+    {
+        return m_buffers[i];
+    }
+
+    // Returns the total size of the segments in bytes.
+    std::size_t size() const
+    {
+        std::size_t size = 0;
+        for(shared_buffer_t const& buffer : m_buffers)
+            size += buffer.size();
+        return size;
+    }
+
+private:
+    std::array<shared_buffer_t, N> m_buffers;
+    std::array<boost::asio::const_buffer, N> m_asio_buffers;
+};
+
+template<typename... Buffers>
+shared_buffer_sequence_t(Buffers&&...)
+-> shared_buffer_sequence_t<sizeof...(Buffers)>;
+
+// The first 'size' bytes of fixed-size storage, such as a std::array
+// allocated from a sharable_pool. Models asio's ConstBufferSequence:
+//
+//  auto storage = make_shared_from_pool(pool);
+//  std::size_t size = serialize<T>::write(message, storage->data())
+//                     - storage->data();
+//  pooled_buffer_t buffer(std::move(storage), size);
+//
+// A shared_buffer_t can follow the pooled bytes, so that a small header
+// can be put in front of a body shared with other messages:
+//
+//  pooled_buffer_t buffer(std::move(storage), size, shared_body);
+//
+// Copies share the storage, which stays alive as long as any copy does.
+template<typename SharedStorage>
+class pooled_buffer_t
+{
+public:
+    using value_type = boost::asio::const_buffer;
+    using const_iterator = value_type const*;
+
+    pooled_buffer_t(SharedStorage storage, std::size_t size)
+    : m_storage(std::move(storage))
+    , m_tail()
+    , m_buffers{{ { m_storage->data(), size } }}
+    , m_count(1)
+    {}
+
+    pooled_buffer_t(SharedStorage storage, std::size_t size,
+                    shared_buffer_t tail)
+    : m_storage(std::move(storage))
+    , m_tail(std::move(tail))
+    , m_buffers{{ { m_storage->data(), size },
+                  boost::asio::const_buffer(m_tail) }}
+    , m_count(2)
+    {}
+
+    const_iterator begin() const { return m_buffers.data(); }
+    const_iterator end() const { return m_buffers.data() + m_count; }
+
+    // Returns the total size in bytes.
+    std::size_t size() const
+    {
+        return m_buffers[0].size() + m_buffers[1].size();
+    }
+
+private:
+    SharedStorage m_storage;
+    shared_buffer_t m_tail;
+    std::array<boost::asio::const_buffer, 2> m_buffers;
+    std::size_t m_count;
+};
+
+#endif
@@ -0,0 +1,133 @@
+#include "buffer.hpp"
+
+#include <catch/catch.hpp>
+
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+TEST_CASE("shared_buffer_t", "[buffer]")
+{
+    SECTION("copies share storage")
+    {
+        shared_buffer_t a(100);
+        a[0] = 'x';
+        shared_buffer_t b = a;
+        REQUIRE(b.data() == a.data());
+        REQUIRE(b.size() == 100);
+
+        shared_buffer_t c = std::move(a);
+        REQUIRE(c.data() == b.data());
+        REQUIRE(a.data() == nullptr);
+        REQUIRE(a.size() == 0);
+
+        b = shared_buffer_t();
+        REQUIRE(c[0] == 'x');
+    }
+
+    SECTION("size classes")
+    {
+        buffer_stats_t const before = buffer_stats();
+        {
+            // 100 bytes goes in the 128 byte class.
+            shared_buffer_t a(100);
+            shared_buffer_t copy = a;
+            buffer_stats_t const during = buffer_stats();
+            auto const& size_class = during.size_classes[1];
+            REQUIRE(size_class.buffer_size == 128);
+            REQUIRE(size_class.in_use == before.size_classes[1].in_use + 1);
+            REQUIRE(size_class.allocations
+                    == before.size_classes[1].allocations + 1);
+            REQUIRE(size_class.reserved >= size_class.in_use);
+        }
+        buffer_stats_t const after = buffer_stats();
+        REQUIRE(after.size_classes[1].in_use
+                == before.size_classes[1].in_use);
+
+        // Freed buffers are reused.
+        char const* data;
+        {
+            shared_buffer_t a(128);
+            data = a.data();
+        }
+        shared_buffer_t b(65);
+        REQUIRE(b.data() == data);
+        REQUIRE(buffer_stats().size_classes[1].reserved
+                == after.size_classes[1].reserved);
+    }
+
+    SECTION("heap fallback")
+    {
+        std::size_t const size = buffer_impl::max_slab_buffer_size + 1;
+        buffer_stats_t const before = buffer_stats();
+        {
+            shared_buffer_t a(size);
+            a[size - 1] = 'x';
+            buffer_stats_t const during = buffer_stats();
+            REQUIRE(during.heap_in_use == before.heap_in_use + 1);
+            REQUIRE(during.heap_allocations == before.heap_allocations + 1);
+        }
+        REQUIRE(buffer_stats().heap_in_use == before.heap_in_use);
+
+        // The largest slab buffers don't fall back.
+        shared_buffer_t b(buffer_impl::max_slab_buffer_size);
+        REQUIRE(buffer_stats().heap_allocations
+                == before.heap_allocations + 1);
+    }
+
+    SECTION("threads")
+    {
+        // Buffers allocated by one thread and freed by another are
+        // counted once each, including after the threads exit.
+        buffer_stats_t const before = buffer_stats();
+        std::vector<shared_buffer_t> buffers;
+        std::thread([&]()
+        {
+            for(int i = 0; i != 1000; ++i)
+                buffers.emplace_back(1000);
+        }).join();
+        REQUIRE(buffer_stats().size_classes[4].in_use
+                == before.size_classes[4].in_use + 1000);
+
+        std::thread([&]() { buffers.clear(); }).join();
+        buffer_stats_t const after = buffer_stats();
+        REQUIRE(after.size_classes[4].in_use
+                == before.size_classes[4].in_use);
+        REQUIRE(after.size_classes[4].allocations
+                == before.size_classes[4].allocations + 1000);
+    }
+
+    SECTION("slices")
+    {
+        shared_buffer_t buffer(10);
+        std::memcpy(buffer.data(), "0123456789", 10);
+        buffer_stats_t const before = buffer_stats();
+
+        shared_buffer_t slice = buffer.slice(2, 5);
+        REQUIRE(slice.data() == buffer.data() + 2);
+        REQUIRE(slice.size() == 5);
+        REQUIRE(std::string(slice.begin(), slice.end()) == "23456");
+
+        shared_buffer_t inner = slice.slice(1, 3);
+        REQUIRE(std::string(inner.begin(), inner.end()) == "345");
+        REQUIRE(slice.slice(5, 0).size() == 0);
+        REQUIRE_THROWS_AS(slice.slice(4, 2), std::out_of_range);
+        REQUIRE_THROWS_AS(slice.slice(6, 0), std::out_of_range);
+        REQUIRE(shared_buffer_t().slice(0, 0).data() == nullptr);
+
+        // Slices keep the storage alive and never allocate.
+        buffer = shared_buffer_t();
+        REQUIRE(inner[0] == '3');
+        buffer_stats_t const after = buffer_stats();
+        REQUIRE(after.size_classes[0].allocations
+                == before.size_classes[0].allocations);
+
+        boost::asio::const_buffer const asio_buffer(inner);
+        REQUIRE(asio_buffer.data() == inner.data());
+        REQUIRE(asio_buffer.size() == 3);
+    }
+}
@@ -0,0 +1,549 @@
+#ifndef COLUMNAR_SERIALIZE_HPP
+#define COLUMNAR_SERIALIZE_HPP
+
+// The parameter 'columnar' serializes lists of variants as runs of
+// consecutive elements holding the same alternative. Each run is written
+// as a struct of arrays rather than an array of structs:
+//
+//  ((update_list_t) (updates) (columnar))
+//
+//  [count]
+//  [alternative][run length][column 0 ...][column 1 ...] ...
+//  [alternative][run length][column 0 ...][column 1 ...] ...
+//
+// Columns are the alternative's members, with SERIALIZED_DATA structs and
+// coord_t flattened into one column per field. Integer columns store the
+// run's first value as a zigzag varint, then the difference from the
+// previous value for the rest, bit packed at the width of the largest:
+//
+//  [first value][width in bits][(run length - 1) * width bits ...]
+//
+// Runs of sorted ids and nearby positions take a few bits per value.
+// Integer members are range checked when read, but their parameters are
+// ignored. Other members are written using their own serializer.
+// Alternatives with no columns are written as runs of one element.
+//
+// Each delta column has a single width, so it is unpacked in batches with
+// read_bit_array rather than a value at a time. Reading is still slower
+// than serialize<update_list_t, varint>, since every column is another
+// pass over the list, but runs of similar values take a fraction of the
+// bytes, which is what matters for lists split across datagrams.
+
+#include <array>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include <eggs/variant.hpp>
+
+#include <int2d/units.hpp>
+
+#include "bit_serialize.hpp"
+#include "serialize.hpp"
+#include "type_index.hpp"
+
+struct columnar {};
+
+namespace serialize_impl
+{
+    // One flattened member of a struct, read or written by S.
+    template<typename S, typename T>
+    struct column_t
+    {
+        T& value;
+    };
+
+    template<typename S, typename T>
+    auto columns(T& t);
+
+    template<typename... Ss, typename Tie, std::size_t... Is>
+    auto member_columns(std::tuple<Ss...>*, Tie tie,
+                        std::index_sequence<Is...>)
+    {
+        return std::tuple_cat(columns<Ss>(std::get<Is>(tie))...);
+    }
+
+    // Returns a tuple of column_t for each of t's flattened members.
+    template<typename S, typename T>
+    auto columns(T& t)
+    {
+        using U = std::remove_const_t<T>;
+        using int_t = std::conditional_t<std::is_const<T>::value,
+                                         int const, int>;
+        if constexpr(is_delta_struct<S>::value)
+        {
+            using members = typename U::serialized_members;
+            return member_columns(
+                static_cast<members*>(nullptr), t.serialized_tie(),
+                std::make_index_sequence<std::tuple_size<members>::value>());
+        }
+        else if constexpr(std::is_same<U, int2d::coord_t>::value)
+        {
+            using column = column_t<serialize<int>, int_t>;
+            return std::tuple<column, column>{ { t.x }, { t.y } };
+        }
+        else
+            return std::tuple<column_t<S, T>>{ { t } };
+    }
+
+    template<typename T>
+    using columns_t = decltype(columns<serialize<T>>(std::declval<T&>()));
+
+    template<typename T>
+    struct is_delta_column
+    : std::integral_constant<bool, std::is_integral<T>::value
+                                   && !std::is_same<T, bool>::value>
+    {};
+
+    using column_first = serialize<std::int64_t, zigzag_varint>;
+    using column_width = serialize<std::uint8_t>;
+
+    inline std::uint64_t zigzag_encode(std::uint64_t delta)
+    {
+        return (delta << 1) ^ (0 - (delta >> 63));
+    }
+
+    inline std::uint64_t zigzag_decode(std::uint64_t z)
+    {
+        return (z >> 1) ^ (0 - (z & 1));
+    }
+
+    // The bits needed to store v, and at least 1.
+    inline unsigned bit_length(std::uint64_t v)
+    {
+        unsigned n = 1;
+        while(v >>= 1)
+            ++n;
+        return n;
+    }
+
+    // True if v, a T stored in 64 bits, fits T. Without branches, so
+    // that a column can be checked as a whole.
+    template<typename T>
+    bool column_fits(std::uint64_t v)
+    {
+        using limits = std::numeric_limits<T>;
+        std::uint64_t const min = static_cast<std::int64_t>(limits::min());
+        std::uint64_t const max = static_cast<std::int64_t>(limits::max());
+        return v - min <= max - min;
+    }
+
+    // Throws unless v, a T stored in 64 bits, fits T.
+    template<typename T>
+    T column_value(std::uint64_t v)
+    {
+        if(!column_fits<T>(v))
+            throw std::overflow_error("serialize::read overflow");
+        return static_cast<T>(v);
+    }
+
+    template<typename C>
+    struct column_traits;
+
+    template<typename S, typename T>
+    struct column_traits<column_t<S, T>>
+    {
+        using serializer = S;
+        using value_type = std::remove_const_t<T>;
+        static constexpr bool delta
+            = is_delta_column<value_type>::value;
+
+        // The fewest bits an element after a run's first can take.
+        static constexpr std::size_t min_bits
+            = delta ? 1 : 8 * min_size<S>();
+    };
+
+    // The fewest bits one element after a run's first can take.
+    template<typename... Cs>
+    constexpr std::size_t run_min_bits(std::tuple<Cs...>*)
+    {
+        return (std::size_t(0) + ... + column_traits<Cs>::min_bits);
+    }
+
+    // Throws unless [begin, end) could hold 'count' elements of at least
+    // 'bits' bits each. Checked before allocating space for them.
+    template<typename It>
+    void check_bit_count(It const begin, It const end, std::size_t count,
+                         std::size_t bits)
+    {
+        std::size_t const bytes = std::distance(begin, end);
+        if(bits && count > bytes / bits * 8 + bytes % bits * 8 / bits)
+            throw std::range_error("serialize::read range too small");
+    }
+
+    // Counts the bytes written through it. Used to implement 'size'.
+    class count_iterator
+    {
+    public:
+        using iterator_category = std::output_iterator_tag;
+        using value_type = void;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = void;
+
+        count_iterator& operator*() { return *this; }
+        count_iterator& operator=(char) { return *this; }
+        count_iterator& operator++() { ++m_count; return *this; }
+        count_iterator operator++(int) { ++m_count; return *this; }
+
+        std::size_t count() const { return m_count; }
+
+    private:
+        std::size_t m_count = 0;
+    };
+
+    template<typename T>
+    struct columnar_list;
+
+    template<template<typename...> class List, typename... Ts,
+             typename... A>
+    struct columnar_list<List<eggs::variant<Ts...>, A...>>
+    {
+        using type = List<eggs::variant<Ts...>, A...>;
+        using value_type = eggs::variant<Ts...>;
+        using size_serialize = serialize<std::size_t, varint>;
+        using which_serialize = serialize<std::uint8_t>;
+
+        static_assert(sizeof...(Ts) < 256, "too many alternatives");
+
+        static constexpr std::size_t min_size = size_serialize::min_size;
+
+        template<typename It>
+        static It read(It const begin, It const end, type& dest)
+        {
+            dest.clear();
+            return append(begin, end, dest);
+        }
+
+        // Like 'read', but adds the elements to the end of 'dest' instead
+        // of replacing its contents. If an exception is thrown, 'dest' is
+        // left as it was.
+        template<typename It>
+        static It append(It const begin, It const end, type& dest)
+        {
+            std::size_t const offset = dest.size();
+            try
+            {
+                return append_runs(begin, end, dest);
+            }
+            catch(...)
+            {
+                dest.erase(std::next(dest.begin(), offset), dest.end());
+                throw;
+            }
+        }
+
+        template<typename It>
+        static It write(type const& src, It const dest)
+        {
+            return write(src.begin(), src.end(), dest);
+        }
+
+        // Writes the elements in [begin, end) of a list as a list.
+        template<typename It>
+        static It write(typename type::const_iterator begin,
+                        typename type::const_iterator const end,
+                        It const dest)
+        {
+            It it = size_serialize::write(std::distance(begin, end), dest);
+            while(begin != end)
+            {
+                auto const run_end = next_run(begin, end);
+                it = write_run(begin, std::distance(begin, run_end), it);
+                begin = run_end;
+            }
+            return it;
+        }
+
+        static std::size_t size(type const& t)
+        {
+            return write(t, count_iterator()).count();
+        }
+
+        // Returns the end of the longest prefix of [begin, end) which
+        // takes at most 'max_size' bytes when written. Lists are split
+        // between runs, or inside a run that doesn't fit on its own.
+        static typename type::const_iterator max_prefix(
+            typename type::const_iterator begin,
+            typename type::const_iterator const end,
+            std::size_t max_size)
+        {
+            // The prefix's size takes no more bytes than the whole's.
+            std::size_t const size_size
+                = size_serialize::size(std::distance(begin, end));
+            if(size_size > max_size)
+                return begin;
+            max_size -= size_size;
+
+            while(begin != end)
+            {
+                auto const run_end = next_run(begin, end);
+                std::size_t const n = std::distance(begin, run_end);
+                std::size_t const size = run_size(begin, n);
+                if(size > max_size)
+                {
+                    // Run sizes only grow with their length, so the
+                    // longest part which fits can be bisected.
+                    std::size_t fits = 0;
+                    std::size_t too_long = n;
+                    while(too_long - fits > 1)
+                    {
+                        std::size_t const mid = fits + (too_long - fits) / 2;
+                        if(run_size(begin, mid) <= max_size)
+                            fits = mid;
+                        else
+                            too_long = mid;
+                    }
+                    return std::next(begin, fits);
+                }
+                max_size -= size;
+                begin = run_end;
+            }
+            return end;
+        }
+
+    private:
+        using const_iterator = typename type::const_iterator;
+        using iterator = typename type::iterator;
+
+        // Alternatives without columns take no input per element, so
+        // nothing would bound their runs' length. Each of their elements
+        // gets a run of its own instead.
+        static constexpr bool has_columns[] =
+            { run_min_bits((columns_t<Ts>*)nullptr) != 0 ... };
+
+        static const_iterator next_run(const_iterator run,
+                                       const_iterator const end)
+        {
+            auto run_end = std::next(run);
+            if(has_columns[run->which()])
+            {
+                while(run_end != end && run_end->which() == run->which())
+                    ++run_end;
+            }
+            return run_end;
+        }
+
+        template<typename It>
+        static It write_run(const_iterator run, std::size_t n, It it)
+        {
+            it = which_serialize::write(run->which(), it);
+            it = size_serialize::write(n, it);
+            return runtime_type_index<run_writer, Ts...>(
+                run->which(), run, n, it);
+        }
+
+        static std::size_t run_size(const_iterator run, std::size_t n)
+        {
+            return write_run(run, n, count_iterator()).count();
+        }
+
+        template<typename It>
+        static It append_runs(It const begin, It const end, type& dest)
+        {
+            std::size_t size;
+            It it = size_serialize::read(begin, end, size);
+
+            // The list grows a run at a time, once each run's size has
+            // been checked against the input.
+            while(size)
+            {
+                std::uint8_t which;
+                std::size_t run_size;
+                it = which_serialize::read(it, end, which);
+                it = size_serialize::read(it, end, run_size);
+                if(run_size == 0 || run_size > size)
+                    throw std::overflow_error("serialize::read overflow");
+
+                it = runtime_type_index<run_reader, Ts...>(
+                    which, it, end, dest, run_size);
+                size -= run_size;
+            }
+            return it;
+        }
+
+        template<typename V>
+        struct run_writer
+        {
+            template<typename It>
+            It operator()(const_iterator run, std::size_t n, It it) const
+            {
+                return write_columns(
+                    run, n, it,
+                    std::make_index_sequence<
+                        std::tuple_size<columns_t<V>>::value>());
+            }
+
+            template<typename It, std::size_t... Is>
+            static It write_columns(const_iterator run, std::size_t n, It it,
+                                    std::index_sequence<Is...> is)
+            {
+                auto const widths = delta_widths(run, n, is);
+                ((it = write_column<Is>(run, n, widths[Is], it)), ...);
+                return it;
+            }
+
+            template<std::size_t I>
+            using traits = column_traits<
+                std::tuple_element_t<I, columns_t<V>>>;
+
+            template<std::size_t I>
+            static auto const& get(const_iterator e)
+            {
+                V const& v = *e->template target<V>();
+                return std::get<I>(columns<serialize<V>>(v)).value;
+            }
+
+            // Zero for columns which aren't delta encoded.
+            template<std::size_t I>
+            static std::uint64_t delta_value(const_iterator e)
+            {
+                if constexpr(traits<I>::delta)
+                    return get<I>(e);
+                else
+                    return 0;
+            }
+
+            // The bits needed by each column's largest delta, found in
+            // one pass over the run.
+            template<std::size_t... Is>
+            static std::array<unsigned, sizeof...(Is)> delta_widths(
+                const_iterator e, std::size_t n, std::index_sequence<Is...>)
+            {
+                std::uint64_t prev[] = { delta_value<Is>(e)... };
+                std::uint64_t max[sizeof...(Is)] = {};
+                const_iterator const run_end = std::next(e, n);
+                for(++e; e != run_end; ++e)
+                {
+                    ((max[Is] |= zigzag_encode(delta_value<Is>(e) 
+                                               - prev[Is]),
+                      prev[Is] = delta_value<Is>(e)), ...);
+                }
+                return {{ bit_length(max[Is])... }};
+            }
+
+            template<std::size_t I, typename It>
+            static It write_column(const_iterator e, std::size_t n,
+                                   unsigned width, It it)
+            {
+                if constexpr(traits<I>::delta)
+                {
+                    std::uint64_t prev = get<I>(e);
+                    it = column_first::write(prev, it);
+                    if(n == 1)
+                        return it;
+
+                    it = column_width::write(width, it);
+                    bit_writer<It> writer(it);
+                    const_iterator const run_end = std::next(e, n);
+                    for(++e; e != run_end; ++e)
+                    {
+                        std::uint64_t const v = get<I>(e);
+                        writer.write(zigzag_encode(v - prev), width);
+                        prev = v;
+                    }
+                    return writer.finish();
+                }
+                else
+                {
+                    for(std::size_t i = 0; i != n; ++i, ++e)
+                        it = traits<I>::serializer::write(get<I>(e), it);
+                    return it;
+                }
+            }
+        };
+
+        template<typename V>
+        struct run_reader
+        {
+            template<typename It>
+            It operator()(It it, It const end, type& dest,
+                          std::size_t n) const
+            {
+                constexpr std::size_t bits
+                    = run_min_bits((columns_t<V>*)nullptr);
+                if(bits == 0 && n != 1)
+                    throw std::overflow_error("serialize::read overflow");
+                check_bit_count(it, end, n - 1, bits);
+                read_budget_t::charge(n, sizeof(value_type));
+
+                std::size_t const offset = dest.size();
+                dest.resize(offset + n, value_type(V()));
+                return read_columns(
+                    it, end, std::next(dest.begin(), offset), n,
+                    std::make_index_sequence<
+                        std::tuple_size<columns_t<V>>::value>());
+            }
+
+            template<typename It, std::size_t... Is>
+            static It read_columns(It it, It const end, iterator run,
+                                   std::size_t n, std::index_sequence<Is...>)
+            {
+                ((it = read_column<Is>(it, end, run, n)), ...);
+                return it;
+            }
+
+            template<std::size_t I>
+            static auto& get(iterator e)
+            {
+                V& v = *e->template target<V>();
+                return std::get<I>(columns<serialize<V>>(v)).value;
+            }
+
+            template<std::size_t I, typename It>
+            static It read_column(It it, It const end, iterator e,
+                                  std::size_t n)
+            {
+                using traits = column_traits<
+                    std::tuple_element_t<I, columns_t<V>>>;
+                using T = typename traits::value_type;
+
+                if constexpr(traits::delta)
+                {
+                    std::int64_t first;
+                    it = column_first::read(it, end, first);
+                    get<I>(e) = column_value<T>(first);
+                    if(n == 1)
+                        return it;
+
+                    std::uint8_t width;
+                    it = column_width::read(it, end, width);
+                    if(width == 0 || width > 64)
+                        throw std::overflow_error("serialize::read overflow");
+
+                    // Values are range checked once the column is read.
+                    // If one doesn't fit, the caller discards the run.
+                    std::uint64_t prev = first;
+                    bool fits = true;
+                    it = read_bit_array(it, end, width, n - 1,
+                        [&](std::uint64_t z)
+                        {
+                            prev += zigzag_decode(z);
+                            fits &= column_fits<T>(prev);
+                            get<I>(++e) = static_cast<T>(prev);
+                        });
+                    if(!fits)
+                        throw std::overflow_error("serialize::read overflow");
+                    return it;
+                }
+                else
+                {
+                    for(std::size_t i = 0; i != n; ++i, ++e)
+                        it = traits::serializer::read(it, end, get<I>(e));
+                    return it;
+                }
+            }
+        };
+    };
+}
+
+template<typename T>
+struct serialize<T, columnar>
+: serialize_impl::columnar_list<T>
+{};
+
+#endif
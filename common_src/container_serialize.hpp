@@ -0,0 +1,201 @@
+#ifndef CONTAINER_SERIALIZE_HPP
+#define CONTAINER_SERIALIZE_HPP
+
+// Serialization of maps and sets: boost's flat_map and flat_set, and the
+// standard ordered and unordered containers. Like lists, they're written
+// as their size followed by their elements; map elements are the key
+// followed by the value. The only parameter is the size's integer type:
+//
+//  ((flat_map<std::uint32_t, int>) (storage) ())
+//  ((flat_set<object_id_t>)        (ids)     (varint))
+//
+// Every map shares one wire format, as does every set, so a std::map
+// written by one end can be read into a flat_map by the other.
+//
+// Flat containers are read into their underlying sequence, which is
+// adopted without any per-element searching when the input is sorted,
+// as it is when written from a flat or ordered container. Other input is
+// sorted once, dropping duplicate keys. Unordered containers reserve
+// space for every element before inserting.
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <set>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+
+#include <boost/container/flat_map.hpp>
+#include <boost/container/flat_set.hpp>
+
+#include "serialize_impl.hpp"
+
+namespace serialize_impl
+{
+    template<typename K, typename V>
+    struct map_entry_serialize
+    {
+        using type = std::pair<K, V>;
+
+        static constexpr std::size_t min_size
+            = (serialize_impl::min_size<serialize<K>>()
+               + serialize_impl::min_size<serialize<V>>());
+
+        template<typename It>
+        static It read(It const begin, It const end, type& dest)
+        {
+            auto it = serialize<K>::read(begin, end, dest.first);
+            return serialize<V>::read(it, end, dest.second);
+        }
+
+        // Pair is also std::pair<K const, V>, as stored in std::map.
+        template<typename Pair, typename It>
+        static It write(Pair const& src, It const dest)
+        {
+            auto it = serialize<K>::write(src.first, dest);
+            return serialize<V>::write(src.second, it);
+        }
+
+        template<typename Pair>
+        static std::size_t size(Pair const& t)
+        {
+            return serialize<K>::size(t.first) + serialize<V>::size(t.second);
+        }
+    };
+
+    // Sets store their keys; maps store key-value pairs.
+    template<typename T, typename = void>
+    struct container_entry
+    {
+        using type = typename T::key_type;
+        using serializer = serialize<type>;
+    };
+
+    template<typename T>
+    struct container_entry<T, std::void_t<typename T::mapped_type>>
+    {
+        using type = std::pair<typename T::key_type, typename T::mapped_type>;
+        using serializer = map_entry_serialize<typename T::key_type,
+                                               typename T::mapped_type>;
+    };
+
+    template<typename T, typename = void>
+    struct is_flat_container : std::false_type {};
+
+    template<typename T>
+    struct is_flat_container<T, std::void_t<typename T::sequence_type>>
+    : std::true_type {};
+
+    template<typename T, typename = void>
+    struct has_reserve : std::false_type {};
+
+    template<typename T>
+    struct has_reserve<T, std::void_t<decltype(
+        std::declval<T&>().reserve(std::size_t()))>>
+    : std::true_type {};
+
+    template<typename T, typename SizeInt = std::uint16_t>
+    struct container_serialize
+    {
+        using type = T;
+        using entry_type = typename container_entry<T>::type;
+        using entry = typename container_entry<T>::serializer;
+        using size_serialize = serialize<std::size_t, SizeInt>;
+
+        static constexpr std::size_t min_size
+            = serialize_impl::min_size<size_serialize>();
+
+        template<typename It>
+        static It read(It const begin, It const end, T& dest)
+        {
+            std::size_t size;
+            auto it = size_serialize::read(begin, end, size);
+            check_count(it, end, size, serialize_impl::min_size<entry>());
+            read_budget_t::charge(size, sizeof(entry_type));
+
+            if constexpr(is_flat_container<T>::value)
+            {
+                typename T::sequence_type seq(size);
+                for(auto& v : seq)
+                    it = entry::read(it, end, v);
+
+                auto const comp = dest.value_comp();
+                auto const unordered = std::adjacent_find(
+                    seq.begin(), seq.end(),
+                    [&](auto const& a, auto const& b) { return !comp(a, b); });
+                if(unordered == seq.end())
+                {
+                    dest.adopt_sequence(boost::container::ordered_unique_range,
+                                        std::move(seq));
+                }
+                else
+                    dest.adopt_sequence(std::move(seq));
+            }
+            else
+            {
+                dest.clear();
+                if constexpr(has_reserve<T>::value)
+                    dest.reserve(size);
+                entry_type v;
+                for(std::size_t i = 0; i != size; ++i)
+                {
+                    it = entry::read(it, end, v);
+                    // Sorted input appends in constant time.
+                    dest.insert(dest.end(), std::move(v));
+                }
+            }
+            return it;
+        }
+
+        template<typename It>
+        static It write(T const& src, It const dest)
+        {
+            auto it = size_serialize::write(src.size(), dest);
+            for(auto const& v : src)
+                it = entry::write(v, it);
+            return it;
+        }
+
+        static std::size_t size(T const& t)
+        {
+            std::size_t size = size_serialize::size(t.size());
+            for(auto const& v : t)
+                size += entry::size(v);
+            return size;
+        }
+    };
+}
+
+template<typename... Ts, typename... P>
+struct serialize<boost::container::flat_map<Ts...>, P...>
+: serialize_impl::container_serialize<boost::container::flat_map<Ts...>, P...>
+{};
+
+template<typename... Ts, typename... P>
+struct serialize<boost::container::flat_set<Ts...>, P...>
+: serialize_impl::container_serialize<boost::container::flat_set<Ts...>, P...>
+{};
+
+template<typename... Ts, typename... P>
+struct serialize<std::map<Ts...>, P...>
+: serialize_impl::container_serialize<std::map<Ts...>, P...>
+{};
+
+template<typename... Ts, typename... P>
+struct serialize<std::set<Ts...>, P...>
+: serialize_impl::container_serialize<std::set<Ts...>, P...>
+{};
+
+template<typename... Ts, typename... P>
+struct serialize<std::unordered_map<Ts...>, P...>
+: serialize_impl::container_serialize<std::unordered_map<Ts...>, P...>
+{};
+
+template<typename... Ts, typename... P>
+struct serialize<std::unordered_set<Ts...>, P...>
+: serialize_impl::container_serialize<std::unordered_set<Ts...>, P...>
+{};
+
+#endif
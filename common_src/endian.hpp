@@ -6,9 +6,64 @@
 #include <cassert>
 #include <cstdint>
 #include <climits>
+#include <cstring>
 #include <iterator>
 #include <type_traits>
 
+// True if the host stores integers in little endian byte order,
+// which is also the byte order used for serialization.
+constexpr bool host_is_little_endian
+    = __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__;
+
+// True for pointers to bytes. These convert whole integers with a single
+// unaligned load or store, swapping the bytes only if the host's byte
+// order differs, rather than shifting in one byte at a time.
+template<typename It>
+struct is_byte_pointer : std::false_type {};
+
+template<typename C>
+struct is_byte_pointer<C*>
+: std::integral_constant<bool, std::is_integral<C>::value
+                               && sizeof(C) == 1
+                               && !std::is_same<std::remove_cv_t<C>,
+                                                bool>::value>
+{};
+
+template<typename T>
+inline T byteswap(T t)
+{
+    static_assert(std::is_integral<T>::value,
+                  "endian conversion only works on integers");
+    using U = std::make_unsigned_t<T>;
+    if constexpr(sizeof(T) == 1)
+        return t;
+    else if constexpr(sizeof(T) == 2)
+        return static_cast<T>(__builtin_bswap16(static_cast<U>(t)));
+    else if constexpr(sizeof(T) == 4)
+        return static_cast<T>(__builtin_bswap32(static_cast<U>(t)));
+    else
+    {
+        static_assert(sizeof(T) == 8, "unsupported integer size");
+        return static_cast<T>(__builtin_bswap64(static_cast<U>(t)));
+    }
+}
+
+template<bool Little, typename T>
+inline void load_endian(void const* p, T& t)
+{
+    std::memcpy(&t, p, sizeof(T));
+    if(Little != host_is_little_endian)
+        t = byteswap(t);
+}
+
+template<bool Little, typename T>
+inline void store_endian(T t, void* p)
+{
+    if(Little != host_is_little_endian)
+        t = byteswap(t);
+    std::memcpy(p, &t, sizeof(T));
+}
+
 template<typename T, int N = sizeof(T) - 1>
 struct endian_impl
 {
@@ -83,8 +138,16 @@ struct endian_impl<T, -1>
 template<typename CharIt, typename T>
 inline CharIt from_little_endian(CharIt it, T& t)
 {
-    t = 0;
-    return endian_impl<T>::from_little_endian(it, t);
+    if constexpr(is_byte_pointer<CharIt>::value)
+    {
+        load_endian<true>(it, t);
+        return it + sizeof(T);
+    }
+    else
+    {
+        t = 0;
+        return endian_impl<T>::from_little_endian(it, t);
+    }
 }
 
 template<typename CharIt>
@@ -99,8 +162,16 @@ inline CharIt from_little_endian(CharIt it, bool& t)
 template<typename CharIt, typename T>
 inline CharIt from_big_endian(CharIt it, T& t)
 {
-    t = 0;
-    return endian_impl<T>::from_big_endian(it, t);
+    if constexpr(is_byte_pointer<CharIt>::value)
+    {
+        load_endian<false>(it, t);
+        return it + sizeof(T);
+    }
+    else
+    {
+        t = 0;
+        return endian_impl<T>::from_big_endian(it, t);
+    }
 }
 
 template<typename CharIt>
@@ -115,7 +186,13 @@ inline CharIt from_big_endian(CharIt it, bool& t)
 template<typename CharIt, typename T>
 inline CharIt to_little_endian(T t, CharIt it)
 {
-    return endian_impl<T>::to_little_endian(t, it);
+    if constexpr(is_byte_pointer<CharIt>::value)
+    {
+        store_endian<true>(t, it);
+        return it + sizeof(T);
+    }
+    else
+        return endian_impl<T>::to_little_endian(t, it);
 }
 
 template<typename CharIt>
@@ -127,7 +204,13 @@ inline CharIt to_little_endian(bool t, CharIt it)
 template<typename CharIt, typename T>
 inline CharIt to_big_endian(T t, CharIt it)
 {
-    return endian_impl<T>::to_big_endian(t, it);
+    if constexpr(is_byte_pointer<CharIt>::value)
+    {
+        store_endian<false>(t, it);
+        return it + sizeof(T);
+    }
+    else
+        return endian_impl<T>::to_big_endian(t, it);
 }
 
 template<typename CharIt>
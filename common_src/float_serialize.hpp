@@ -1,56 +1,122 @@
 #ifndef FLOAT_SERIALIZE_HPP
 #define FLOAT_SERIALIZE_HPP
 
-// TODO
+// Floating point values are serialized as fixed-point integers.
+// The parameter quantized<Min, Max, Bits> maps [Min, Max] onto the
+// 2^Bits evenly spaced values from Min to Max inclusive:
+//
+//  ((float) (sub_x) (quantized<0, 1, 8>))     // 1/255 steps, 1 byte
+//  ((double) (vel)  (quantized<-16, 16, 12>)) // 32/4095 steps, 2 bytes
+//
+// Values are rounded to the nearest step, so the error is at most half a
+// step. Writing a value outside [Min, Max], or NaN, throws.
+//
+// Byte-aligned serialization rounds Bits up to a whole integer type, while
+// serialize<T, bit_packed> uses exactly Bits bits.
 
-template<typename S>
-S to_signed(std::make_unsigned_t<S> u)
-{
-    static_assert(std::is_signed<S>::value);
-    using U = std::make_unsigned_t<S>;
-    using L = std::numeric_limits<S>;
-    
-    if(u <= L::max())
-        return static_cast<S>(u);
-        
-    if(u >= static_cast<U>(L::min()))
-        return static_cast<S>(u - L::min()) + L::max();
-        
-    throw std::runtime_error("bad to_signed cast");
-}
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+
+#include "bit_serialize.hpp"
+#include "serialize_impl.hpp"
 
-struct float_serialized_t
+template<std::intmax_t Min, std::intmax_t Max, unsigned Bits>
+struct quantized
 {
-    std::uint16_t exponent;
-    std::uint32_t mantissa;
+    static_assert(Min < Max, "quantized range must not be empty");
+    static_assert(Bits > 0 && Bits <= 32, "quantized<Bits> must be 1 to 32");
+
+    using int_type = serialize_impl::least_int_t<Bits, false>;
+
+    static constexpr std::uint64_t max_int = (std::uint64_t(1) << Bits) - 1;
+
+    // The distance between adjacent representable values.
+    static constexpr double step = double(Max - Min) / max_int;
+
+    template<typename T>
+    static int_type to_int(T value)
+    {
+        if(!(value >= T(Min) && value <= T(Max)))
+            throw std::overflow_error("serialize::write overflow");
+        return static_cast<int_type>(
+            std::lround((double(value) - Min) / step));
+    }
+
+    template<typename T>
+    static T from_int(std::uint64_t i)
+    {
+        if(i > max_int)
+            throw std::overflow_error("serialize::read overflow");
+        // Min and Max are exact, so compute them without the step.
+        if(i == max_int)
+            return T(Max);
+        return static_cast<T>(Min + double(i) * step);
+    }
 };
 
-float_serialized_t write(float number)
+namespace serialize_impl
 {
-    int exponent;
-    std::uint32_t mantissa = 0;
-    if(std::isinf(number))
-        exponent = UINT16_MAX >> 1;
-    else if(std::isnan(number))
-        exponent = (UINT16_MAX >> 1) - 1;
-    else
-        mantissa = UINT32_MAX * std::abs(frexp(number, &exponent));
-    std::uint16_t exponent16 = exponent;
-    exponent16 = (exponent16 << 1) | std::signbit(number);
-    return { exponent16, mantissa };
-}
+    template<typename T, std::intmax_t Min, std::intmax_t Max, unsigned Bits>
+    struct base_<T, false, false, false, quantized<Min, Max, Bits>>
+    {
+        static_assert(std::is_floating_point<T>::value,
+                      "quantized only applies to floating point types");
 
-float read(float_serialized_t fp)
-{
-    float f;
-    if(fp.exponent >> 1 == UINT16_MAX >> 1)
-        f = INFINITY;
-    else if(fp.exponent >> 1 == (UINT16_MAX >> 1) - 1)
-        f = NAN;
-    else
-        f = std::ldexp((float)fp.mantissa / UINT32_MAX, 
-                       to_signed<std::int16_t>(fp.exponent) >> 1);
-    return (fp.exponent & 1) ? -f : f;
+        using type = T;
+        using q = quantized<Min, Max, Bits>;
+        using int_type = typename q::int_type;
+
+        static constexpr std::size_t const_size = sizeof(int_type);
+
+        template<typename It>
+        static It read(It const begin, It const end, T& dest)
+        {
+            check_range(begin, end, const_size);
+            return read_unchecked(begin, dest);
+        }
+
+        template<typename It>
+        static It read_unchecked(It const begin, T& dest)
+        {
+            int_type i;
+            auto it = read_little_endian(begin, i);
+            dest = q::template from_int<T>(i);
+            return it;
+        }
+
+        template<typename It>
+        static It write(T const& src, It const dest)
+        {
+            return write_little_endian(q::to_int(src), dest);
+        }
+
+        static std::size_t size(T const&)
+        {
+            return const_size;
+        }
+    };
+
+    template<typename T, std::intmax_t Min, std::intmax_t Max, unsigned Bits>
+    struct bit_base_<T, false, false, quantized<Min, Max, Bits>>
+    {
+        using q = quantized<Min, Max, Bits>;
+
+        static constexpr std::size_t const_bits = Bits;
+
+        template<typename Reader>
+        static void read(Reader& reader, T& dest)
+        {
+            dest = q::template from_int<T>(reader.read(Bits));
+        }
+
+        template<typename Writer>
+        static void write(T const& src, Writer& writer)
+        {
+            writer.write(q::to_int(src), Bits);
+        }
+    };
 }
 
 #endif
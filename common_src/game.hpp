@@ -6,6 +6,7 @@
 #include <list>
 #include <map>
 #include <memory>
+#include <memory_resource>
 #include <vector>
 
 #include <boost/container/flat_map.hpp>
@@ -17,6 +18,7 @@
 #include <int2d/geometry.hpp>
 #include <int2d/grid.hpp>
 
+#include "columnar_serialize.hpp"
 #include "serialize.hpp"
 
 using namespace int2d;
@@ -55,7 +57,7 @@ struct update_create_object_t
 {
     SERIALIZED_DATA
     (
-        ((object_id_t) (object_id) ())
+        ((object_id_t) (object_id) (varint))
         ((coord_t)     (position)  ())
     )
 };
@@ -64,10 +66,12 @@ struct update_destroy_object_t
 {
     SERIALIZED_DATA
     (
-        ((object_id_t) (object_id) ())
+        ((object_id_t) (object_id) (varint))
     )
 };
 
+// Sent for every moving object on every tick. The id stays fixed-width
+// so that the struct keeps a const_size and is read with one bounds check.
 struct update_object_position_t
 {
     SERIALIZED_DATA
@@ -81,18 +85,22 @@ struct update_create_player_t
 {
     SERIALIZED_DATA
     (
-        ((player_id_t) (player_id) ())
-        ((object_id_t) (object_id) ())
+        ((player_id_t) (player_id) (varint))
+        ((object_id_t) (object_id) (varint))
     )
 };
 
 
+// Uses a polymorphic allocator so that decoded updates can be placed
+// in an arena_t. Default-constructed lists use the heap.
+using update_list_t = std::pmr::deque<update_t>;
+
 struct diff_t
 {
     SERIALIZED_DATA
     (
-        ((aut_t)                (update_from) ())
-        ((std::deque<update_t>) (updates)     ())
+        ((aut_t)         (update_from) (varint))
+        ((update_list_t) (updates)     (columnar))
     )
 };
 
@@ -229,9 +237,9 @@ public:
     {
         SERIALIZED_DATA
         (
-            ((dimen_t) (dimen) (std::uint8_t))
-            ((std::vector<update_create_object_t>) (objects) ())
-            ((std::vector<update_create_player_t>) (players) ())
+            ((dimen_t) (dimen) (std::uint16_t))
+            ((std::vector<update_create_object_t>) (objects) (varint))
+            ((std::vector<update_create_player_t>) (players) (varint))
         )
     };
 
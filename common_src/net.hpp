@@ -3,6 +3,8 @@
 
 #include <eggs/variant.hpp>
 
+#include "buffer.hpp"
+#include "buffer_sequence.hpp"
 #include "serialize.hpp"
 
 using cts_tcp_message_t = eggs::variant
@@ -20,7 +22,7 @@ struct version_t
     static std::uint32_t const correct_magic_number = 0xDEADBEEF;
     // This value should be incremented as the netcode protocol gets updated
     // with breaking changes.
-    static std::uint32_t const correct_protocol_version = 1;
+    static std::uint32_t const correct_protocol_version = 6;
 
     SERIALIZED_DATA
     (
@@ -56,7 +58,7 @@ struct cts_tcp_login_t
 {
     SERIALIZED_DATA
     (
-        ((std::string) (username) ())
+        ((std::string) (username) (varint))
     )
 };
 
@@ -88,6 +90,52 @@ struct stc_tcp_game_state_t
     )
 };
 
+// Serializes a TCP header and message in one pass over the message.
+// The header's payload size is written after the payload is.
+template<typename Header, typename Message>
+shared_buffer_t serialize_tcp_message(Message const& message)
+{
+    using header_serialize = serialize<Header>;
+    using message_serialize = serialize<Message, void>;
+
+    Header header = { message.which(), 0 };
+
+    buffer_sink_t sink;
+    auto it = header_serialize::write(header, sink.out());
+    message_serialize::write(message, it);
+
+    header.payload_size = sink.size() - header_serialize::const_size;
+    header_serialize::write(header, sink.data());
+    return sink.release();
+}
+
+// A TCP message body serialized once, to be sent to any number of
+// recipients behind their own headers.
+struct tcp_body_t
+{
+    std::size_t opcode;
+    shared_buffer_t buffer;
+};
+
+template<typename Message>
+tcp_body_t serialize_tcp_body(Message const& message)
+{
+    buffer_sink_t sink;
+    serialize<Message, void>::write(message, sink.out());
+    return { message.which(), sink.release() };
+}
+
+// Returns the header and the shared body as separate segments.
+template<typename Header>
+shared_buffer_sequence_t<2> tcp_message_buffers(tcp_body_t const& body)
+{
+    using header_serialize = serialize<Header>;
+    Header const header = { body.opcode, body.buffer.size() };
+    shared_buffer_t header_buffer(header_serialize::const_size);
+    header_serialize::write(header, header_buffer.begin());
+    return shared_buffer_sequence_t<2>(std::move(header_buffer), body.buffer);
+}
+
 ///////////////////////////////////////
 // udp
 
@@ -113,10 +161,11 @@ struct cts_udp_message_body_t
 {
     SERIALIZED_DATA
     (
-        ((cts_input_t) (input) ())
+        ((cts_input_t) (input) (bits<3>))
     )
 };
 
+// cts_udp_message_t is serialized with serialize<T, bit_packed>.
 struct cts_udp_message_t
 {
     SERIALIZED_DATA
@@ -136,8 +185,8 @@ struct stc_udp_header_t
 {
     SERIALIZED_DATA
     (
-        ((std::uint16_t) (time)       ())
-        ((std::uint8_t)  (delta_time) ())
+        ((std::uint16_t) (time)                   ())
+        ((std::uint8_t)  (delta_time)             (bits<5>))
         ((std::uint16_t) (last_received_sequence) ())
     )
 };
@@ -150,6 +199,9 @@ struct stc_udp_message_body_t
     )
 };
 
+// stc_udp_message_t's header and body are each serialized with
+// serialize<T, bit_packed>, one after the other. This lets a body
+// be shared by datagrams with different headers.
 struct stc_udp_message_t
 {
     SERIALIZED_DATA
@@ -4,43 +4,444 @@
 // Fixed-size, thread-safe memory pools, intended to be used for 
 // allocating buffers for ASIO without std::malloc overhead/fragmentation.
 
+#include <algorithm>
 #include <array>
 #include <atomic>
 #include <cassert>
+#include <chrono>
+#include <cstdint>
 #include <memory>
+#include <mutex>
 #include <type_traits>
+#include <vector>
 
-template<typename BlockType, std::size_t NumBlocks>
+// A snapshot of a pool's usage, from stats(). Used to size pools from
+// real traffic.
+struct pool_stats_t
+{
+    std::size_t capacity;   // Blocks the pool holds without falling back.
+    std::size_t in_use;     // Blocks allocated.
+    std::size_t cached;     // Free blocks cached by threads (magazines).
+
+    // The most blocks ever in use at once. With magazines, this is
+    // measured when a cache is refilled, so cached blocks count too.
+    std::size_t high_water;
+
+    // Allocations which found the pool empty. make_shared_from_pool then
+    // falls back to 'new', and free_list_pool allocates another chunk.
+    std::size_t fallbacks;
+
+    // One in every 'stats_sample_period' allocations from a pool is
+    // timed, counted per thread when the pool has magazines.
+    std::size_t alloc_samples;
+    double alloc_mean_ns;
+    double alloc_max_ns;
+};
+
+constexpr std::size_t stats_sample_period = 64;
+
+namespace pool_impl
+{
+    using clock_type = std::chrono::steady_clock;
+
+    inline std::size_t ns_since(clock_type::time_point start) noexcept
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            clock_type::now() - start).count();
+    }
+
+    template<typename Count>
+    void fill_latency_stats(pool_stats_t& stats, Count const& samples,
+                            Count const& total_ns, Count const& max_ns)
+    {
+        stats.alloc_samples = samples;
+        stats.alloc_mean_ns = samples ? double(total_ns) / samples : 0.0;
+        stats.alloc_max_ns = double(max_ns);
+    }
+}
+
+// alloc and free are lock-free and O(1). Free blocks form a stack of
+// indices, linked through 'next'. The head is stored with a tag that
+// changes on every push and pop, so a compare-exchange fails if the head
+// was popped and pushed back in between (the ABA problem). The number of
+// blocks taken off the stack is counted apart, for stats() only.
+//
+// With a MagazineSize, each thread also caches up to 2 * MagazineSize
+// free blocks, in the style of tcmalloc and jemalloc. Most alloc and free
+// calls then only touch the calling thread's cache, and the shared stack
+// is refilled from or returned to MagazineSize blocks at a time, with a
+// single compare-exchange. A block may be freed by a different thread
+// than the one which allocated it. Blocks cached by a thread go back to
+// the pool when the thread exits.
+template<typename BlockType, std::size_t NumBlocks,
+         std::size_t MagazineSize = 0>
 class pool_template
 {
 static_assert(std::is_standard_layout<BlockType>::value, 
               "pool type must be standard layout"); 
+static_assert(NumBlocks < (std::uint64_t(1) << 32),
+              "too many blocks to leave the tag 32 bits");
 public:
     using block_type = BlockType;
     using value_type = typename BlockType::value_type;
     static constexpr std::size_t size = NumBlocks;
+    static constexpr std::size_t magazine_size = MagazineSize;
+
+    pool_template() : blocks{}, head(make_head(0, 0))
+    {
+        for(std::size_t i = 0; i != NumBlocks; ++i)
+            next[i].store(i + 1, std::memory_order_relaxed);
+        if constexpr(MagazineSize != 0)
+            control = std::make_shared<control_t>();
+    }
+
+    ~pool_template()
+    {
+        if constexpr(MagazineSize != 0)
+        {
+            std::lock_guard<std::mutex> lock(control->mutex);
+            control->alive = false;
+        }
+    }
 
-    pool_template() : blocks{} {}
     pool_template(pool_template const&) = delete;
     pool_template& operator=(pool_template const&) = delete;
 
     value_type* alloc() noexcept
     {
-        for(block_type& block : blocks)
-            if(!block.allocated.test_and_set(std::memory_order_acq_rel))
-                return &block.value;
-        return nullptr;
+        magazine_t* magazine = nullptr;
+        if constexpr(MagazineSize != 0)
+            magazine = local_magazine();
+
+        if(!sample_this_call(magazine))
+            return counted_alloc(magazine);
+
+        auto const start = pool_impl::clock_type::now();
+        value_type* const ptr = counted_alloc(magazine);
+        std::size_t const ns = pool_impl::ns_since(start);
+
+        alloc_samples.fetch_add(1, std::memory_order_relaxed);
+        alloc_total_ns.fetch_add(ns, std::memory_order_relaxed);
+        update_max(alloc_max_ns, ns);
+        return ptr;
     }
 
     void free(value_type* ptr) noexcept
     {
-        if(ptr)
-            reinterpret_cast<block_type*>(ptr)->allocated.clear(
-                std::memory_order_release);
+        if(!ptr)
+            return;
+
+        if constexpr(MagazineSize != 0)
+        {
+            if(magazine_t* magazine = local_magazine())
+            {
+                std::size_t count = magazine->count();
+                if(count == magazine->ptrs.size())
+                {
+                    count -= MagazineSize;
+                    push(magazine->ptrs.data() + count, MagazineSize);
+                }
+                magazine->ptrs[count++] = ptr;
+                magazine->set_count(count);
+                return;
+            }
+        }
+
+        push(&ptr, 1);
+    }
+
+    // Thread-safe. Blocks cached by threads are counted apart from those
+    // in use, so that an idle pool with magazines doesn't look full.
+    pool_stats_t stats() const noexcept
+    {
+        pool_stats_t stats;
+        stats.capacity = NumBlocks;
+        stats.cached = 0;
+        if constexpr(MagazineSize != 0)
+        {
+            std::lock_guard<std::mutex> lock(control->mutex);
+            for(magazine_t const* m = control->magazines; m; m = m->next)
+                stats.cached += m->count();
+        }
+        // The counts are read at slightly different times.
+        std::size_t const taken = std::clamp<std::ptrdiff_t>(
+            this->taken.load(std::memory_order_relaxed), 0, NumBlocks);
+        stats.in_use = taken - std::min(taken, stats.cached);
+        stats.high_water = high_water.load(std::memory_order_relaxed);
+        stats.fallbacks = fallbacks.load(std::memory_order_relaxed);
+        pool_impl::fill_latency_stats(
+            stats, alloc_samples.load(std::memory_order_relaxed),
+            alloc_total_ns.load(std::memory_order_relaxed),
+            alloc_max_ns.load(std::memory_order_relaxed));
+        return stats;
     }
 
 private:
+    struct magazine_t;
+
+    // True for one in every stats_sample_period allocations from this
+    // pool. Counted in the thread's magazine when there is one, so that
+    // threads don't contend over the count.
+    bool sample_this_call(magazine_t* magazine) noexcept
+    {
+        std::size_t const calls = magazine
+            ? ++magazine->calls
+            : alloc_calls.fetch_add(1, std::memory_order_relaxed) + 1;
+        return calls % stats_sample_period == 0;
+    }
+
+    value_type* counted_alloc(magazine_t* magazine) noexcept
+    {
+        value_type* const ptr = alloc_block(magazine);
+        if(!ptr)
+            fallbacks.fetch_add(1, std::memory_order_relaxed);
+        return ptr;
+    }
+
+    value_type* alloc_block(magazine_t* magazine) noexcept
+    {
+        if(magazine)
+        {
+            std::size_t count = magazine->count();
+            if(count == 0)
+                count = pop(magazine->ptrs.data(), MagazineSize);
+            if(count == 0)
+                return nullptr;
+            magazine->set_count(--count);
+            return magazine->ptrs[count];
+        }
+
+        value_type* ptr;
+        return pop(&ptr, 1) ? ptr : nullptr;
+    }
+
+    // Shared with the threads caching blocks, which may outlive the pool.
+    // Lists the caches, so that stats() can count the blocks they hold.
+    struct control_t
+    {
+        std::mutex mutex;
+        std::atomic<bool> alive{true};
+        magazine_t* magazines = nullptr; // Linked through 'next'.
+    };
+
+    struct magazine_t
+    {
+        magazine_t() = default;
+        magazine_t(magazine_t const&) = delete;
+        magazine_t& operator=(magazine_t const&) = delete;
+        ~magazine_t() { release(); }
+
+        void bind(pool_template* pool) noexcept
+        {
+            owner = pool;
+            control = pool->control;
+
+            std::lock_guard<std::mutex> lock(control->mutex);
+            next = control->magazines;
+            if(next)
+                next->prev = this;
+            control->magazines = this;
+        }
+
+        // Returns the cached blocks to the pool, if it still exists.
+        void release() noexcept
+        {
+            if(control)
+            {
+                std::lock_guard<std::mutex> lock(control->mutex);
+                if(count() && control->alive.load(std::memory_order_relaxed))
+                    owner->push(ptrs.data(), count());
+                (prev ? prev->next : control->magazines) = next;
+                if(next)
+                    next->prev = prev;
+            }
+            control.reset();
+            prev = next = nullptr;
+            set_count(0);
+        }
+
+        // Only the owning thread sets the count, but stats() may read it
+        // from any thread.
+        std::size_t count() const noexcept
+        {
+            return m_count.load(std::memory_order_relaxed);
+        }
+
+        void set_count(std::size_t count) noexcept
+        {
+            m_count.store(count, std::memory_order_relaxed);
+        }
+
+        pool_template* owner = nullptr;
+        std::shared_ptr<control_t> control;
+        magazine_t* prev = nullptr;
+        magazine_t* next = nullptr;
+        std::size_t calls = 0;
+        std::array<value_type*, MagazineSize * 2> ptrs;
+
+    private:
+        std::atomic<std::size_t> m_count{0};
+    };
+
+    // How many pools of one type each thread can cache blocks for.
+    // Further pools are used without a cache.
+    static constexpr std::size_t max_cached_pools = 4;
+
+    // Returns the calling thread's cache for this pool, or null.
+    magazine_t* local_magazine() noexcept
+    {
+        thread_local std::array<magazine_t, max_cached_pools> magazines;
+
+        magazine_t* unused = nullptr;
+        for(magazine_t& magazine : magazines)
+        {
+            if(magazine.control == control)
+                return &magazine;
+            if(!unused && (!magazine.control
+                           || !magazine.control->alive.load(
+                               std::memory_order_relaxed)))
+            {
+                unused = &magazine;
+            }
+        }
+
+        if(unused)
+        {
+            unused->release();
+            unused->bind(this);
+        }
+        return unused;
+    }
+
+    // Pops up to n blocks with a single compare-exchange.
+    // Returns how many were popped.
+    std::size_t pop(value_type** out, std::size_t n) noexcept
+    {
+        std::uint64_t old_head = head.load(std::memory_order_acquire);
+        for(;;)
+        {
+            // 'next' may have changed if a block was allocated by
+            // another thread, but then so has the tag.
+            std::size_t count = 0;
+            std::uint32_t index = head_index(old_head);
+            for(; index != NumBlocks && count != n; ++count)
+            {
+                out[count] = &blocks[index].value;
+                index = next[index].load(std::memory_order_relaxed);
+            }
+
+            if(count == 0)
+                return 0;
+
+            std::uint64_t const new_head
+                = make_head(index, head_tag(old_head) + 1);
+            if(head.compare_exchange_weak(old_head, new_head,
+                                          std::memory_order_acquire,
+                                          std::memory_order_acquire))
+            {
+                std::ptrdiff_t const now = taken.fetch_add(
+                    count, std::memory_order_relaxed) + count;
+                if(now > 0)
+                    update_max(high_water, now);
+                return count;
+            }
+        }
+    }
+
+    // Pushes n blocks with a single compare-exchange.
+    void push(value_type* const* ptrs, std::size_t n) noexcept
+    {
+        assert(n);
+
+        // Link the blocks to each other first, then to the stack.
+        for(std::size_t i = 0; i + 1 < n; ++i)
+            next[index_of(ptrs[i])].store(index_of(ptrs[i + 1]),
+                                          std::memory_order_relaxed);
+
+        std::uint32_t const first = index_of(ptrs[0]);
+        std::uint32_t const last = index_of(ptrs[n - 1]);
+        std::uint64_t old_head = head.load(std::memory_order_relaxed);
+        std::uint64_t new_head;
+        do
+        {
+            next[last].store(head_index(old_head),
+                             std::memory_order_relaxed);
+            new_head = make_head(first, head_tag(old_head) + 1);
+        }
+        while(!head.compare_exchange_weak(old_head, new_head,
+                                          std::memory_order_release,
+                                          std::memory_order_relaxed));
+        taken.fetch_sub(n, std::memory_order_relaxed);
+    }
+
+    std::uint32_t index_of(value_type* ptr) const noexcept
+    {
+        std::uint32_t const index
+            = reinterpret_cast<block_type*>(ptr) - blocks.data();
+        assert(index < NumBlocks);
+        return index;
+    }
+
+    static void update_max(std::atomic<std::size_t>& max,
+                           std::size_t value) noexcept
+    {
+        std::size_t old = max.load(std::memory_order_relaxed);
+        while(old < value
+              && !max.compare_exchange_weak(old, value,
+                                            std::memory_order_relaxed))
+        {}
+    }
+
+    static constexpr unsigned bit_width(std::uint64_t n)
+    {
+        unsigned bits = 0;
+        for(; n; n >>= 1)
+            ++bits;
+        return bits;
+    }
+
+    // The head packs the index of the first free block, just wide enough
+    // to hold NumBlocks, with the tag in the rest. A compare-exchange
+    // could only be fooled by a thread stalled for a whole cycle of the
+    // tag, 2^32 or more updates.
+    static constexpr unsigned index_bits = bit_width(NumBlocks);
+    static constexpr std::uint64_t index_mask
+        = (std::uint64_t(1) << index_bits) - 1;
+
+    static constexpr std::uint64_t make_head(std::uint64_t index,
+                                             std::uint64_t tag)
+    {
+        // The tag's high bits fall off the end, wrapping it.
+        return index | (tag << index_bits);
+    }
+
+    static constexpr std::uint32_t head_index(std::uint64_t head)
+    {
+        return head & index_mask;
+    }
+
+    static constexpr std::uint64_t head_tag(std::uint64_t head)
+    {
+        return head >> index_bits;
+    }
+
     std::array<block_type, NumBlocks> blocks;
+    std::array<std::atomic<std::uint32_t>, NumBlocks> next;
+    std::shared_ptr<control_t> control;
+
+    // Index of the first free block, or NumBlocks when full, with a tag.
+    // Kept on its own cache line, away from the blocks.
+    alignas(64) std::atomic<std::uint64_t> head;
+
+    // Statistics, away from the head. 'taken' is updated after each
+    // compare-exchange, so it may briefly lag the stack, even below 0.
+    alignas(64) std::atomic<std::ptrdiff_t> taken{0};
+    std::atomic<std::size_t> high_water{0};
+    std::atomic<std::size_t> fallbacks{0};
+    std::atomic<std::size_t> alloc_calls{0};
+    std::atomic<std::size_t> alloc_samples{0};
+    std::atomic<std::size_t> alloc_total_ns{0};
+    std::atomic<std::size_t> alloc_max_ns{0};
 };
 
 template<typename T>
@@ -48,26 +449,26 @@ struct simple_pool_block
 {
     using value_type = T;
     value_type value; // Must be first member.
-    std::atomic_flag allocated;
 };
 
-template<typename T, std::size_t NumBlocks>
+template<typename T, std::size_t NumBlocks, std::size_t MagazineSize = 0>
 struct sharable_pool_block
 {
     using value_type = T;
     value_type value; // Must be first member.
-    std::atomic_flag allocated;
     std::atomic<int> refcount;
-    pool_template<sharable_pool_block, NumBlocks>* owner;
+    pool_template<sharable_pool_block, NumBlocks, MagazineSize>* owner;
 };
 
-template<typename T, std::size_t NumBlocks>
-using simple_pool = pool_template<simple_pool_block<T>, NumBlocks>;
+template<typename T, std::size_t NumBlocks, std::size_t MagazineSize = 0>
+using simple_pool 
+    = pool_template<simple_pool_block<T>, NumBlocks, MagazineSize>;
 
 // Sharable pool allows the allocation of shared_pooled_ptrs.
-template<typename T, std::size_t NumBlocks>
+template<typename T, std::size_t NumBlocks, std::size_t MagazineSize = 0>
 using sharable_pool 
-    = pool_template<sharable_pool_block<T, NumBlocks>, NumBlocks>;
+    = pool_template<sharable_pool_block<T, NumBlocks, MagazineSize>, 
+                    NumBlocks, MagazineSize>;
 
 // A smart pointer that behaves like shared_ptr, but is designed to
 // be used with sharable_pool instead.
@@ -75,14 +476,14 @@ using sharable_pool
 // See libc++ for the cleanest/easiest implementation of
 // std::shared_ptr (to copy from), and cppreference.com for some details.
 // (Stay away from Boost's implementation!)
-template<typename T, std::size_t NumBlocks>
+template<typename T, std::size_t NumBlocks, std::size_t MagazineSize = 0>
 class shared_pooled_ptr
 {
 template<typename P>
-friend shared_pooled_ptr<typename P::value_type, P::size> 
+friend shared_pooled_ptr<typename P::value_type, P::size, P::magazine_size>
 make_shared_from_pool(P& pool);
 public:
-    using pool_type = sharable_pool<T, NumBlocks>;
+    using pool_type = sharable_pool<T, NumBlocks, MagazineSize>;
     using block_type = typename pool_type::block_type;
     using element_type = T;
 
@@ -146,7 +547,7 @@ private:
 };
 
 template<typename P>
-shared_pooled_ptr<typename P::value_type, P::size> 
+shared_pooled_ptr<typename P::value_type, P::size, P::magazine_size>
 make_shared_from_pool(P& pool)
 {
     using block_type = typename P::block_type;
@@ -165,7 +566,8 @@ make_shared_from_pool(P& pool)
         block_ptr = new block_type;
         block_ptr->owner = nullptr;
     }
-    return shared_pooled_ptr<value_type, P::size>(*block_ptr);
+    return shared_pooled_ptr<value_type, P::size, P::magazine_size>(
+        *block_ptr);
 }
 
 // A simple pool-like container where objects are created in chunks
@@ -190,13 +592,16 @@ struct free_list_pool
 
     T* alloc()
     {
-        if(free_list.empty())
-            add_chunk();
+        if(++alloc_calls % stats_sample_period != 0)
+            return pop();
 
-        assert(!free_list.empty());
+        auto const start = pool_impl::clock_type::now();
+        T* const ret = pop();
+        std::size_t const ns = pool_impl::ns_since(start);
 
-        T* ret = free_list.back();
-        free_list.pop_back();
+        ++alloc_samples;
+        alloc_total_ns += ns;
+        alloc_max_ns = std::max(alloc_max_ns, ns);
         return ret;
     }
 
@@ -209,7 +614,44 @@ struct free_list_pool
         free_list.push_back(t);
     }
 
+    // Fallbacks count the chunks added after the first, which is the
+    // pool's normal capacity.
+    pool_stats_t stats() const noexcept
+    {
+        pool_stats_t stats;
+        stats.capacity = chunks.size() * chunk_size;
+        stats.in_use = in_use();
+        stats.cached = 0;
+        stats.high_water = high_water;
+        stats.fallbacks = fallbacks;
+        pool_impl::fill_latency_stats(stats, alloc_samples, alloc_total_ns,
+                                      alloc_max_ns);
+        return stats;
+    }
+
 private:
+    std::size_t in_use() const noexcept
+    {
+        return chunks.size() * chunk_size - free_list.size();
+    }
+
+    T* pop()
+    {
+        if(free_list.empty())
+        {
+            if(!chunks.empty())
+                ++fallbacks;
+            add_chunk();
+        }
+
+        assert(!free_list.empty());
+
+        T* ret = free_list.back();
+        free_list.pop_back();
+        high_water = std::max(high_water, in_use());
+        return ret;
+    }
+
     void add_chunk()
     {
         // Reserve first to get exception safety.
@@ -229,6 +671,13 @@ private:
 
     std::vector<std::unique_ptr<T[]>> chunks;
     std::vector<T*> free_list;
+
+    std::size_t high_water = 0;
+    std::size_t fallbacks = 0;
+    std::size_t alloc_calls = 0;
+    std::size_t alloc_samples = 0;
+    std::size_t alloc_total_ns = 0;
+    std::size_t alloc_max_ns = 0;
 };
 
 #endif
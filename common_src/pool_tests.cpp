@@ -0,0 +1,283 @@
+#include "pool.hpp"
+
+#include <catch/catch.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <set>
+#include <thread>
+#include <vector>
+
+TEST_CASE("pool_template", "[pool]")
+{
+    using pool_t = simple_pool<int, 8>;
+    auto pool = std::make_unique<pool_t>();
+
+    SECTION("alloc until full")
+    {
+        std::set<int*> ptrs;
+        for(std::size_t i = 0; i != pool_t::size; ++i)
+        {
+            int* ptr = pool->alloc();
+            REQUIRE(ptr);
+            ptrs.insert(ptr);
+        }
+        REQUIRE(ptrs.size() == pool_t::size);
+        REQUIRE(pool->alloc() == nullptr);
+
+        // Freed blocks are reused.
+        int* const ptr = *ptrs.begin();
+        pool->free(ptr);
+        REQUIRE(pool->alloc() == ptr);
+        REQUIRE(pool->alloc() == nullptr);
+
+        for(int* p : ptrs)
+            pool->free(p);
+        pool->free(nullptr);
+        for(std::size_t i = 0; i != pool_t::size; ++i)
+            REQUIRE(pool->alloc());
+    }
+
+    SECTION("shared_pooled_ptr")
+    {
+        using spool_t = sharable_pool<int, 2>;
+        auto spool = std::make_unique<spool_t>();
+        {
+            auto a = make_shared_from_pool(*spool);
+            auto b = make_shared_from_pool(*spool);
+            auto c = make_shared_from_pool(*spool); // Falls back to 'new'.
+            *a = 1;
+            *b = 2;
+            *c = 3;
+            REQUIRE(spool->alloc() == nullptr);
+            auto a2 = a;
+            a.reset();
+            REQUIRE(*a2 == 1);
+        }
+        REQUIRE(spool->alloc());
+        REQUIRE(spool->alloc());
+        REQUIRE(spool->alloc() == nullptr);
+    }
+}
+
+TEST_CASE("pool_template magazines", "[pool]")
+{
+    using pool_t = simple_pool<int, 64, 4>;
+    auto pool = std::make_unique<pool_t>();
+
+    // Every block can be allocated by one thread, through its cache.
+    std::vector<int*> ptrs;
+    while(int* ptr = pool->alloc())
+        ptrs.push_back(ptr);
+    REQUIRE(ptrs.size() == pool_t::size);
+
+    // Blocks freed by another thread go to its cache, then back to the
+    // pool when it exits.
+    std::thread([&]()
+    {
+        for(int* ptr : ptrs)
+            pool->free(ptr);
+    }).join();
+
+    std::set<int*> reallocated;
+    while(int* ptr = pool->alloc())
+        reallocated.insert(ptr);
+    REQUIRE(reallocated.size() == pool_t::size);
+
+    for(int* ptr : reallocated)
+        pool->free(ptr);
+
+    // A thread may exit after the pool it cached blocks for is gone.
+    auto other_pool = std::make_unique<pool_t>();
+    std::atomic<bool> cached(false);
+    std::atomic<bool> destroyed(false);
+    std::thread thread([&]()
+    {
+        other_pool->free(other_pool->alloc());
+        cached = true;
+        while(!destroyed)
+            std::this_thread::yield();
+    });
+    while(!cached)
+        std::this_thread::yield();
+    other_pool.reset();
+    destroyed = true;
+    thread.join();
+}
+
+template<typename Pool>
+static void test_pool_threads()
+{
+    constexpr std::size_t num_blocks = Pool::size;
+    constexpr std::size_t num_threads = 4;
+    constexpr std::size_t iterations = 20000;
+
+    auto pool = std::make_unique<Pool>();
+    std::atomic<bool> failed(false);
+
+    // Each thread holds a few blocks at a time and checks that nobody
+    // else wrote to them while they were held.
+    std::vector<std::thread> threads;
+    for(std::size_t t = 0; t != num_threads; ++t)
+    {
+        threads.emplace_back([&, t]()
+        {
+            std::vector<std::size_t*> held;
+            for(std::size_t i = 0; i != iterations; ++i)
+            {
+                if(std::size_t* ptr = pool->alloc())
+                {
+                    *ptr = t;
+                    held.push_back(ptr);
+                }
+                if(held.size() == 8 || (i % 3 == 0 && !held.empty()))
+                {
+                    for(std::size_t* ptr : held)
+                    {
+                        if(*ptr != t)
+                            failed = true;
+                        pool->free(ptr);
+                    }
+                    held.clear();
+                }
+            }
+            for(std::size_t* ptr : held)
+                pool->free(ptr);
+        });
+    }
+    for(std::thread& thread : threads)
+        thread.join();
+
+    REQUIRE(!failed);
+
+    // Every block made it back.
+    std::vector<std::size_t*> ptrs;
+    while(std::size_t* ptr = pool->alloc())
+        ptrs.push_back(ptr);
+    std::sort(ptrs.begin(), ptrs.end());
+    REQUIRE(ptrs.size() == num_blocks);
+    REQUIRE(std::unique(ptrs.begin(), ptrs.end()) == ptrs.end());
+}
+
+TEST_CASE("pool_template threads", "[pool]")
+{
+    test_pool_threads<simple_pool<std::size_t, 64>>();
+    test_pool_threads<simple_pool<std::size_t, 64, 4>>();
+}
+
+TEST_CASE("pool stats", "[pool]")
+{
+    SECTION("pool_template")
+    {
+        using pool_t = simple_pool<int, 8>;
+        auto pool = std::make_unique<pool_t>();
+
+        pool_stats_t stats = pool->stats();
+        REQUIRE(stats.capacity == 8);
+        REQUIRE(stats.in_use == 0);
+        REQUIRE(stats.cached == 0);
+        REQUIRE(stats.high_water == 0);
+        REQUIRE(stats.fallbacks == 0);
+
+        std::vector<int*> ptrs;
+        for(std::size_t i = 0; i != 6; ++i)
+            ptrs.push_back(pool->alloc());
+        for(std::size_t i = 0; i != 4; ++i)
+        {
+            pool->free(ptrs.back());
+            ptrs.pop_back();
+        }
+
+        stats = pool->stats();
+        REQUIRE(stats.in_use == 2);
+        REQUIRE(stats.high_water == 6);
+
+        while(int* ptr = pool->alloc())
+            ptrs.push_back(ptr);
+        REQUIRE(pool->alloc() == nullptr);
+
+        stats = pool->stats();
+        REQUIRE(stats.in_use == 8);
+        REQUIRE(stats.high_water == 8);
+        REQUIRE(stats.fallbacks == 2);
+
+        for(int* ptr : ptrs)
+            pool->free(ptr);
+        REQUIRE(pool->stats().in_use == 0);
+    }
+
+    SECTION("magazines")
+    {
+        // Blocks in a thread's cache aren't in use, but they were taken
+        // from the pool at once.
+        using pool_t = simple_pool<int, 64, 4>;
+        auto pool = std::make_unique<pool_t>();
+        int* const ptr = pool->alloc();
+        REQUIRE(pool->stats().in_use == 1);
+        REQUIRE(pool->stats().cached == 3);
+        pool->free(ptr);
+        REQUIRE(pool->stats().in_use == 0);
+        REQUIRE(pool->stats().cached == 4);
+        REQUIRE(pool->stats().high_water == 4);
+
+        // Caches of other threads count too, until the threads exit.
+        std::size_t cached_by_both = 0;
+        std::thread([&pool, &cached_by_both]()
+            {
+                pool->free(pool->alloc());
+                cached_by_both = pool->stats().cached;
+            }).join();
+        REQUIRE(cached_by_both == 8);
+        REQUIRE(pool->stats().cached == 4);
+        REQUIRE(pool->stats().in_use == 0);
+    }
+
+    SECTION("free_list_pool")
+    {
+        free_list_pool<int, 4> pool;
+        REQUIRE(pool.stats().capacity == 0);
+
+        std::vector<int*> ptrs;
+        for(std::size_t i = 0; i != 5; ++i)
+            ptrs.push_back(pool.alloc());
+        pool.free(ptrs.back());
+
+        pool_stats_t const stats = pool.stats();
+        REQUIRE(stats.capacity == 8);
+        REQUIRE(stats.in_use == 4);
+        REQUIRE(stats.high_water == 5);
+        REQUIRE(stats.fallbacks == 1);
+    }
+
+    SECTION("latency")
+    {
+        using pool_t = simple_pool<int, 8>;
+        auto pool = std::make_unique<pool_t>();
+        for(std::size_t i = 0; i != 4 * stats_sample_period; ++i)
+            pool->free(pool->alloc());
+
+        pool_stats_t const stats = pool->stats();
+        REQUIRE(stats.alloc_samples == 4);
+        REQUIRE(stats.alloc_mean_ns <= stats.alloc_max_ns);
+    }
+
+    SECTION("latency of alternating pools")
+    {
+        // Each pool samples its own allocations, whatever else the
+        // thread allocates from.
+        auto a = std::make_unique<simple_pool<int, 8>>();
+        auto b = std::make_unique<simple_pool<int, 8, 2>>();
+        free_list_pool<int, 4> c;
+        for(std::size_t i = 0; i != 4 * stats_sample_period; ++i)
+        {
+            a->free(a->alloc());
+            b->free(b->alloc());
+            c.free(c.alloc());
+        }
+        REQUIRE(a->stats().alloc_samples == 4);
+        REQUIRE(b->stats().alloc_samples == 4);
+        REQUIRE(c.stats().alloc_samples == 4);
+    }
+}
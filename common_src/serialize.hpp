@@ -1,6 +1,7 @@
 #ifndef SERIALIZE_HPP
 #define SERIALIZE_HPP
 
+#include <algorithm>
 #include <array>
 #include <cstdint>
 #include <string>
@@ -11,6 +12,9 @@
 
 #include <int2d/units.hpp>
 
+#include "bit_serialize.hpp"
+#include "container_serialize.hpp"
+#include "float_serialize.hpp"
 #include "serialize_impl.hpp"
 #include "type_index.hpp"
 
@@ -28,52 +32,80 @@ struct serialize<std::array<T, N>, P...>
   ::template array_size<std::array<T, N>, P...>
 {
     using type = std::array<T, N>;
+    using element = serialize<T, P...>;
+
+    static constexpr bool bulk 
+        = serialize_impl::is_bulk_copyable<T, P...>::value;
 
     template<typename It>
     static It read(It const begin, It const end, type& dest)
+    {
+        if constexpr(bulk)
+        {
+            serialize_impl::check_range(begin, end, N * sizeof(T));
+            return serialize_impl::read_bytes(begin, N * sizeof(T), 
+                                              dest.data());
+        }
+        else if constexpr(serialize_impl::has_const_size<element>::value)
+        {
+            serialize_impl::check_range(begin, end, N * element::const_size);
+            return read_unchecked(begin, dest);
+        }
+        else
+        {
+            auto it = begin;
+            for(auto& v : dest)
+                it = element::read(it, end, v);
+            return it;
+        }
+    }
+
+    template<typename It>
+    static It read_unchecked(It const begin, type& dest)
     {
         auto it = begin;
         for(auto& v : dest)
-            it = serialize<T, P...>::read(it, end, v);
+            it = element::read_unchecked(it, v);
         return it;
     }
 
     template<typename It>
     static It write(type const& src, It const dest)
     {
-        auto it = dest;
-        for(T const& v : src)
-            it = serialize<T, P...>::write(v, it);
-        return it;
+        if constexpr(bulk)
+            return serialize_impl::write_bytes(src.data(), N * sizeof(T),
+                                               dest);
+        else
+        {
+            auto it = dest;
+            for(T const& v : src)
+                it = element::write(v, it);
+            return it;
+        }
     }
 };
 
 template<>
-struct serialize<std::string>
+struct serialize<std::string, nul_terminated>
 {
     using type = std::string;
 
+    static constexpr std::size_t min_size = 1;
+
     template<typename It>
     static It read(It const begin, It const end, type& dest)
     {
-        auto it = begin;
-        while(*it != '\0')
-        {
-            if(it == end)
-            {
-                throw std::range_error(
-                    "serialize::read range too small");
-            }
-            ++it;
-        }
-        dest.assign(begin, it);
+        auto const it = serialize_impl::find_byte(begin, end, '\0');
+        if(it == end)
+            throw std::range_error("serialize::read range too small");
+        serialize_impl::read_string(begin, std::distance(begin, it), dest);
         return std::next(it);
     }
 
     template<typename It>
     static It write(type const& src, It const dest)
     {
-        return std::copy(src.data(), src.data() + src.size() + 1, dest);
+        return serialize_impl::write_bytes(src.c_str(), src.size() + 1, dest);
     }
 
     static std::size_t size(type const& t)
@@ -82,19 +114,76 @@ struct serialize<std::string>
     }
 };
 
+template<>
+struct serialize<std::string>
+: serialize<std::string, nul_terminated>
+{};
+
+// Strings preceded by their length, stored as SizeInt.
+// Unlike NUL-terminated strings, these may contain NUL bytes.
+template<typename SizeInt>
+struct serialize<std::string, SizeInt>
+{
+    using type = std::string;
+    using size_serialize = serialize<std::size_t, SizeInt>;
+
+    static constexpr std::size_t min_size
+        = serialize_impl::min_size<size_serialize>();
+
+    template<typename It>
+    static It read(It const begin, It const end, type& dest)
+    {
+        std::size_t n;
+        auto it = size_serialize::read(begin, end, n);
+        serialize_impl::check_range(it, end, n);
+        return serialize_impl::read_string(it, n, dest);
+    }
+
+    template<typename It>
+    static It write(type const& src, It const dest)
+    {
+        auto it = size_serialize::write(src.size(), dest);
+        return serialize_impl::write_bytes(src.data(), src.size(), it);
+    }
+
+    static std::size_t size(type const& t)
+    {
+        return size_serialize::size(t.size()) + t.size();
+    }
+};
+
 template<typename... Ts>
 struct serialize<eggs::variant<Ts...>>
 : serialize<eggs::variant<Ts...>, std::uint8_t>
 {};
 
+namespace serialize_impl
+{
+    template<typename Int, typename V, typename = void>
+    struct variant_max_size {};
+
+    template<typename Int, typename... Ts>
+    struct variant_max_size<Int, eggs::variant<Ts...>, std::enable_if_t<
+        (is_bounded<serialize<Ts>>::value && ...)>>
+    {
+        static constexpr std::size_t max_size
+            = (serialize<Int>::const_size
+               + std::max({ std::size_t(0),
+                            serialize_impl::max_size<serialize<Ts>>()... }));
+    };
+}
+
 template<typename Int, typename... Ts>
 struct serialize<eggs::variant<Ts...>, Int>
+: serialize_impl::variant_max_size<Int, eggs::variant<Ts...>>
 {
     using type = eggs::variant<Ts...>;
 
     static_assert(sizeof...(Ts) < std::numeric_limits<Int>::max(),
                   "variant must be smaller than integer type");
 
+    static constexpr std::size_t min_size = serialize<Int>::const_size;
+
     template<typename It>
     static It read(It const begin, It const end, type& dest)
     {
@@ -164,8 +253,15 @@ struct serialize<int2d::coord_t, Int>
     template<typename It>
     static It read(It const begin, It const end, type& dest)
     {
-        auto it = serialize<int, Int>::read(begin, end, dest.x);
-        return serialize<int, Int>::read(it, end, dest.y);
+        serialize_impl::check_range(begin, end, const_size);
+        return read_unchecked(begin, dest);
+    }
+
+    template<typename It>
+    static It read_unchecked(It const begin, type& dest)
+    {
+        auto it = serialize<int, Int>::read_unchecked(begin, dest.x);
+        return serialize<int, Int>::read_unchecked(it, dest.y);
     }
 
     template<typename It>
@@ -183,6 +279,29 @@ struct serialize<int2d::coord_t>
 : serialize<int2d::coord_t, std::int32_t>
 {};
 
+template<typename... P>
+struct serialize_impl::bit_serialize<int2d::coord_t, P...>
+{
+    using type = int2d::coord_t;
+    using component = bit_serialize<int, P...>;
+
+    static constexpr std::size_t const_bits = component::const_bits * 2;
+
+    template<typename Reader>
+    static void read(Reader& reader, type& dest)
+    {
+        component::read(reader, dest.x);
+        component::read(reader, dest.y);
+    }
+
+    template<typename Writer>
+    static void write(type const& src, Writer& writer)
+    {
+        component::write(src.x, writer);
+        component::write(src.y, writer);
+    }
+};
+
 template<typename Int>
 struct serialize<int2d::dimen_t, Int>
 {
@@ -194,8 +313,15 @@ struct serialize<int2d::dimen_t, Int>
     template<typename It>
     static It read(It const begin, It const end, type& dest)
     {
-        auto it = serialize<int, Int>::read(begin, end, dest.w);
-        return serialize<int, Int>::read(it, end, dest.h);
+        serialize_impl::check_range(begin, end, const_size);
+        return read_unchecked(begin, dest);
+    }
+
+    template<typename It>
+    static It read_unchecked(It const begin, type& dest)
+    {
+        auto it = serialize<int, Int>::read_unchecked(begin, dest.w);
+        return serialize<int, Int>::read_unchecked(it, dest.h);
     }
 
     template<typename It>
@@ -213,14 +339,24 @@ struct serialize<int2d::dimen_t>
 : serialize<int2d::dimen_t, std::int32_t>
 {};
 
-template<typename T, typename = void>
+template<typename T>
 struct serialize_has_const_size
-: std::false_type
+: serialize_impl::has_const_size<T>
 {};
 
-template<typename T>
-struct serialize_has_const_size<T, std::void_t<decltype(T::const_size)>>
-: std::true_type
+// The most bytes that the serializer S can write. Defined for serializers
+// with a const_size, and for bounded ones such as varints, or structs and
+// variants of bounded members.
+template<typename S>
+struct serialize_max_size
+: std::integral_constant<std::size_t, serialize_impl::max_size<S>()>
+{};
+
+// True if the serializers Ss, written one after another, always fit in
+// N bytes. False for unbounded serializers.
+template<std::size_t N, typename... Ss>
+struct serialize_fits
+: std::integral_constant<bool, serialize_impl::fits<N, Ss...>()>
 {};
 
 template<typename T>
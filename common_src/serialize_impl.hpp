@@ -1,15 +1,22 @@
 #ifndef SERIALIZE_IMPL
 #define SERIALIZE_IMPL
 
+#include <algorithm>
 #include <cstdint>
+#include <cstring>
+#include <deque>
 #include <iterator>
 #include <limits>
 #include <list>
+#include <stdexcept>
+#include <string>
 #include <tuple>
 #include <type_traits>
 #include <utility>
+#include <vector>
 
 #include <boost/preprocessor/seq/for_each.hpp>
+#include <boost/preprocessor/seq/for_each_i.hpp>
 #include <boost/preprocessor/seq/elem.hpp>
 #include <boost/preprocessor/tuple/elem.hpp>
 #include <boost/preprocessor/tuple/enum.hpp>
@@ -17,15 +24,72 @@
 
 #include "endian.hpp"
 
-namespace std
-{
-    template<typename T, typename Allocator> class vector;
-    template<typename T, typename Allocator> class deque;
-}
-
 template<typename T, typename... Params>
 struct serialize;
 
+// Parameters which encode integers using a variable number of bytes,
+// 7 bits per byte with the least significant group first.
+// Small values take fewer bytes. zigzag_varint is for signed values,
+// which it interleaves so that small negative numbers stay small:
+// 0, -1, 1, -2, 2, ...
+struct varint {};
+struct zigzag_varint {};
+
+// Parameter for strings which are followed by a NUL byte, rather than
+// preceded by their length. This is the default for std::string.
+struct nul_terminated {};
+
+// Limits how many bytes reads may allocate, so that sizes read off the
+// wire can't force huge allocations. A budget applies to every read on
+// the thread that constructed it until it goes out of scope:
+//
+//  read_budget_t budget(64 * 1024);
+//  serialize<cts_tcp_message_t>::read(begin, end, message);
+//
+// Reads which would exceed the budget throw std::length_error.
+// Nested budgets are all charged, so an inner budget can't grant more
+// than an outer one has left. Without a budget, reads are unlimited.
+class read_budget_t
+{
+public:
+    explicit read_budget_t(std::size_t bytes)
+    : m_remaining(bytes)
+    , m_prev(current)
+    {
+        current = this;
+    }
+
+    ~read_budget_t() { current = m_prev; }
+
+    read_budget_t(read_budget_t const&) = delete;
+    read_budget_t& operator=(read_budget_t const&) = delete;
+
+    std::size_t remaining() const { return m_remaining; }
+
+    // Charges the budgets in scope for 'count' objects of 'size' bytes.
+    static void charge(std::size_t count, std::size_t size)
+    {
+        if(!current)
+            return;
+
+        if(size && count > std::numeric_limits<std::size_t>::max() / size)
+            throw std::length_error("serialize::read budget exceeded");
+        std::size_t const bytes = count * size;
+
+        for(read_budget_t* b = current; b; b = b->m_prev)
+            if(bytes > b->m_remaining)
+                throw std::length_error("serialize::read budget exceeded");
+        for(read_budget_t* b = current; b; b = b->m_prev)
+            b->m_remaining -= bytes;
+    }
+
+private:
+    std::size_t m_remaining;
+    read_budget_t* m_prev;
+
+    static inline thread_local read_budget_t* current = nullptr;
+};
+
 namespace serialize_impl
 {
     template<typename T>
@@ -40,12 +104,273 @@ namespace serialize_impl
     template<typename... T>
     struct is_listlike<std::list<T...> > : std::true_type {};
 
+    template<typename T>
+    struct is_contiguous : std::false_type {};
+
+    template<typename T, typename A>
+    struct is_contiguous<std::vector<T, A>> : std::true_type {};
+
+    // True for iterators over contiguous bytes, which can be passed
+    // to std::memcpy.
+    template<typename It, typename = void>
+    struct is_contiguous_bytes : std::false_type {};
+
+    template<typename C>
+    struct is_contiguous_bytes<C*, std::enable_if_t<sizeof(C) == 1>>
+    : std::true_type {};
+
+    template<typename It>
+    struct is_contiguous_bytes<It, std::enable_if_t<
+        std::is_same<It, std::vector<char>::iterator>::value
+        || std::is_same<It, std::vector<char>::const_iterator>::value
+        || std::is_same<It, std::string::iterator>::value
+        || std::is_same<It, std::string::const_iterator>::value>>
+    : std::true_type {};
+
+    // True when T's serialized representation is identical to its 
+    // in-memory representation, allowing arrays of T to be copied in bulk.
+    template<typename T, typename... P>
+    struct is_bulk_copyable
+    : std::integral_constant<bool,
+        host_is_little_endian
+        && std::is_integral<T>::value
+        && !std::is_same<T, bool>::value
+        && sizeof...(P) <= 1
+        && (std::is_same<T, P>::value && ...)>
+    {};
+
+    // True for output iterators which can append many bytes at once,
+    // such as buffer_sink_t::iterator.
+    template<typename It, typename = void>
+    struct has_append : std::false_type {};
+
+    template<typename It>
+    struct has_append<It, std::void_t<decltype(
+        std::declval<It&>().append(std::declval<void const*>(), 0))>>
+    : std::true_type {};
+
+    template<typename It>
+    It read_bytes(It const begin, std::size_t n, void* dest)
+    {
+        if constexpr(is_contiguous_bytes<It>::value)
+        {
+            if(n)
+                std::memcpy(dest, &*begin, n);
+            return begin + n;
+        }
+        else
+        {
+            auto it = begin;
+            char* out = static_cast<char*>(dest);
+            for(std::size_t i = 0; i != n; ++i, ++it)
+                out[i] = *it;
+            return it;
+        }
+    }
+
+    // Integers are converted through pointers when the iterator is
+    // contiguous, which endian.hpp does with a single load or store.
+    template<typename It, typename T>
+    It read_little_endian(It const begin, T& t)
+    {
+        if constexpr(is_contiguous_bytes<It>::value)
+        {
+            from_little_endian(&*begin, t);
+            return begin + sizeof(T);
+        }
+        else
+            return from_little_endian(begin, t);
+    }
+
+    template<typename It, typename T>
+    It write_little_endian(T t, It const dest)
+    {
+        if constexpr(is_contiguous_bytes<It>::value)
+        {
+            to_little_endian(t, &*dest);
+            return dest + sizeof(T);
+        }
+        else
+            return to_little_endian(t, dest);
+    }
+
+    template<typename It>
+    It write_bytes(void const* src, std::size_t n, It const dest)
+    {
+        char const* in = static_cast<char const*>(src);
+        if constexpr(is_contiguous_bytes<It>::value)
+        {
+            if(n)
+                std::memcpy(&*dest, in, n);
+            return dest + n;
+        }
+        else if constexpr(has_append<It>::value)
+            return It(dest).append(in, n);
+        else
+            return std::copy(in, in + n, dest);
+    }
+
+    // Returns the first position of 'c' in [begin, end), or 'end'.
+    template<typename It>
+    It find_byte(It const begin, It const end, char c)
+    {
+        if constexpr(is_contiguous_bytes<It>::value)
+        {
+            if(begin == end)
+                return end;
+            char const* const first = &*begin;
+            void const* const found = std::memchr(first, c, end - begin);
+            return found ? begin + (static_cast<char const*>(found) - first)
+                         : end;
+        }
+        else
+            return std::find(begin, end, c);
+    }
+
+    // Reads 'n' bytes into 'dest', replacing its contents.
+    template<typename It>
+    It read_string(It const begin, std::size_t n, std::string& dest)
+    {
+        read_budget_t::charge(n, 1);
+        if constexpr(is_contiguous_bytes<It>::value)
+        {
+            if(n)
+                dest.assign(&*begin, n);
+            else
+                dest.clear();
+            return begin + n;
+        }
+        else
+        {
+            It const end = std::next(begin, n);
+            dest.assign(begin, end);
+            return end;
+        }
+    }
+
+    template<typename It>
+    void check_range(It const begin, It const end, std::size_t n)
+    {
+        if((std::size_t)std::distance(begin, end) < n)
+            throw std::range_error("serialize::read range too small");
+    }
+
+    template<typename S, typename = void>
+    struct has_const_size : std::false_type {};
+
+    template<typename S>
+    struct has_const_size<S, std::void_t<decltype(S::const_size)>>
+    : std::true_type {};
+
+    template<typename S, typename = void>
+    struct has_min_size : std::false_type {};
+
+    template<typename S>
+    struct has_min_size<S, std::void_t<decltype(S::min_size)>>
+    : std::true_type {};
+
+    // The fewest bytes that S can read, or 0 if unknown.
+    // Serializers without a const_size can declare a 'min_size'.
+    template<typename S>
+    constexpr std::size_t min_size()
+    {
+        if constexpr(has_const_size<S>::value)
+            return S::const_size;
+        else if constexpr(has_min_size<S>::value)
+            return S::min_size;
+        else
+            return 0;
+    }
+
+    template<typename M>
+    struct tuple_min_size;
+
+    template<typename... Ms>
+    struct tuple_min_size<std::tuple<Ms...>>
+    : std::integral_constant<std::size_t, (min_size<Ms>() + ... + 0)>
+    {};
+
+    template<typename S, typename = void>
+    struct has_max_size : std::false_type {};
+
+    template<typename S>
+    struct has_max_size<S, std::void_t<decltype(S::max_size)>>
+    : std::true_type {};
+
+    // True if S never writes more than a fixed number of bytes.
+    // Serializers without a const_size can declare a 'max_size'.
+    template<typename S>
+    struct is_bounded
+    : std::integral_constant<bool, (has_const_size<S>::value
+                                    || has_max_size<S>::value)>
+    {};
+
+    // The most bytes that S can write.
+    template<typename S>
+    constexpr std::size_t max_size()
+    {
+        static_assert(is_bounded<S>::value, "serializer has no max_size");
+        if constexpr(has_const_size<S>::value)
+            return S::const_size;
+        else
+            return S::max_size;
+    }
+
+    // True if Ss, written one after another, always fit in N bytes.
+    template<std::size_t N, typename... Ss>
+    constexpr bool fits()
+    {
+        if constexpr((is_bounded<Ss>::value && ...))
+            return (max_size<Ss>() + ... + 0) <= N;
+        else
+            return false;
+    }
+
+    // Declares 'max_size' when every serializer in M is bounded.
+    template<typename M, typename = void>
+    struct tuple_max_size {};
+
+    template<typename... Ms>
+    struct tuple_max_size<std::tuple<Ms...>,
+                          std::enable_if_t<(is_bounded<Ms>::value && ...)>>
+    {
+        static constexpr std::size_t max_size
+            = (serialize_impl::max_size<Ms>() + ... + 0);
+    };
+
+    template<typename S, std::size_t N, typename = void>
+    struct array_max_size {};
+
+    template<typename S, std::size_t N>
+    struct array_max_size<S, N, std::enable_if_t<is_bounded<S>::value>>
+    {
+        static constexpr std::size_t max_size
+            = serialize_impl::max_size<S>() * N;
+    };
+
+    // Throws unless [begin, end) could hold 'count' values of at least
+    // 'size' bytes each. Checked before allocating space for the values.
+    template<typename It>
+    void check_count(It const begin, It const end, std::size_t count,
+                     std::size_t size)
+    {
+        if(size && count > (std::size_t)std::distance(begin, end) / size)
+            throw std::range_error("serialize::read range too small");
+    }
+
     template<typename... P>
     struct with_params
     {
         template<typename A, typename = std::void_t<>>
         struct array_size
+        : array_max_size<serialize<typename A::value_type, P...>,
+                         std::tuple_size<A>::value>
         {
+            static constexpr std::size_t min_size
+                = (serialize_impl::min_size<serialize<typename A::value_type,
+                                                      P...>>()
+                   * std::tuple_size<A>::value);
+
             static std::size_t size(A const& t)
             {
                 std::size_t size = 0;
@@ -72,7 +397,10 @@ namespace serialize_impl
 
     template<typename T, typename M, typename = std::void_t<>>
     struct members_size
+    : tuple_max_size<M>
     {
+        static constexpr std::size_t min_size = tuple_min_size<M>::value;
+
         static std::size_t size(T const& t)
         {
             return t.serialized_size();
@@ -138,11 +466,17 @@ namespace serialize_impl
         template<typename It>
         static It read(It const begin, It const end, T& dest)
         {
-            if((std::size_t)std::distance(begin, end) < const_size)
-                throw std::range_error("serialize::read range too small");
+            check_range(begin, end, const_size);
+            return read_unchecked(begin, dest);
+        }
 
+        // Like 'read', but assumes the caller has already checked that
+        // at least 'const_size' bytes are available.
+        template<typename It>
+        static It read_unchecked(It const begin, T& dest)
+        {
             Cast c;
-            auto it = from_little_endian(begin, c);
+            auto it = read_little_endian(begin, c);
 
             using common = std::common_type_t<Underlying, Cast>;
             if(common(c) < common(std::numeric_limits<Underlying>::min())
@@ -164,8 +498,8 @@ namespace serialize_impl
             {
                 throw std::overflow_error("serialize::write overflow");
             }
-            Cast c = src;
-            return to_little_endian(c, dest);
+            Cast c = static_cast<Cast>(src);
+            return write_little_endian(c, dest);
         }
 
         static std::size_t size(T const&)
@@ -174,6 +508,98 @@ namespace serialize_impl
         }
     };
 
+    template<typename T, typename Underlying, bool ZigZag>
+    struct varint_serialize
+    {
+        using type = T;
+        using unsigned_type = std::make_unsigned_t<Underlying>;
+
+        static_assert(!ZigZag || std::is_signed<Underlying>::value,
+                      "zigzag_varint requires a signed type");
+
+        static constexpr unsigned digits 
+            = std::numeric_limits<unsigned_type>::digits;
+        static constexpr std::size_t min_size = 1;
+        static constexpr std::size_t max_size = (digits + 6) / 7;
+
+        template<typename It>
+        static It read(It const begin, It const end, T& dest)
+        {
+            // Most values are small enough to fit in one byte.
+            if(begin != end && !(static_cast<unsigned char>(*begin) & 0x80))
+            {
+                dest = static_cast<T>(
+                    decode(static_cast<unsigned char>(*begin)));
+                return std::next(begin);
+            }
+
+            unsigned_type v = 0;
+            auto it = begin;
+            for(unsigned shift = 0;; shift += 7)
+            {
+                if(it == end)
+                    throw std::range_error("serialize::read range too small");
+
+                unsigned char const byte = *it;
+                ++it;
+
+                unsigned_type const group = byte & 0x7F;
+                if(shift >= digits 
+                   || unsigned_type(group << shift) >> shift != group)
+                {
+                    throw std::overflow_error("serialize::read overflow");
+                }
+                v |= unsigned_type(group << shift);
+
+                if(!(byte & 0x80))
+                    break;
+            }
+            dest = static_cast<T>(decode(v));
+            return it;
+        }
+
+        template<typename It>
+        static It write(T const& src, It const dest)
+        {
+            unsigned_type v = encode(src);
+            auto it = dest;
+            for(; v >= 0x80; v >>= 7, ++it)
+                *it = static_cast<char>((v & 0x7F) | 0x80);
+            *it = static_cast<char>(v);
+            return ++it;
+        }
+
+        static std::size_t size(T const& t)
+        {
+            std::size_t size = 1;
+            for(unsigned_type v = encode(t); v >= 0x80; v >>= 7)
+                ++size;
+            return size;
+        }
+
+    private:
+        static unsigned_type encode(T const& t)
+        {
+            Underlying const u = static_cast<Underlying>(t);
+            if constexpr(ZigZag)
+            {
+                return (u < 0 
+                        ? ~(unsigned_type(u) << 1) 
+                        : unsigned_type(u) << 1);
+            }
+            else
+                return unsigned_type(u);
+        }
+
+        static Underlying decode(unsigned_type v)
+        {
+            if constexpr(ZigZag)
+                return static_cast<Underlying>((v & 1) ? ~(v >> 1) : v >> 1);
+            else
+                return static_cast<Underlying>(v);
+        }
+    };
+
     template
     < typename T
     , bool IsIntegral
@@ -196,10 +622,27 @@ namespace serialize_impl
     {
         using type = T;
 
+        // Structs with a compile-time size are decoded using a single
+        // bounds check for the whole struct.
+        static constexpr bool fixed_layout
+            = has_const_size<base_size<T>>::value;
+
         template<typename It>
         static It read(It const begin, It const end, T& dest)
         {
-            return dest.read_serialized(begin, end);
+            if constexpr(fixed_layout)
+            {
+                check_range(begin, end, base_size<T>::const_size);
+                return dest.read_serialized_unchecked(begin);
+            }
+            else
+                return dest.read_serialized(begin, end);
+        }
+
+        template<typename It>
+        static It read_unchecked(It const begin, T& dest)
+        {
+            return dest.read_serialized_unchecked(begin);
         }
 
         template<typename It>
@@ -207,6 +650,26 @@ namespace serialize_impl
         {
             return src.write_serialized(dest);
         }
+
+        // Delta encoding against a baseline both ends already have.
+        // See SERIALIZED_DATA.
+        template<typename It>
+        static It read_delta(It const begin, It const end, T const& baseline,
+                             T& dest)
+        {
+            return dest.read_serialized_delta(baseline, begin, end);
+        }
+
+        template<typename It>
+        static It write_delta(T const& src, T const& baseline, It const dest)
+        {
+            return src.write_serialized_delta(baseline, dest);
+        }
+
+        static std::size_t delta_size(T const& src, T const& baseline)
+        {
+            return src.serialized_delta_size(baseline);
+        }
     };
 
     template<typename T>
@@ -224,6 +687,16 @@ namespace serialize_impl
     : int_serialize<T, T, Int>
     {};
 
+    template<typename T>
+    struct base_<T, true, false, false, varint>
+    : varint_serialize<T, T, false>
+    {};
+
+    template<typename T>
+    struct base_<T, true, false, false, zigzag_varint>
+    : varint_serialize<T, T, true>
+    {};
+
     template<typename T>
     struct base_<T, false, true, false>
     : int_serialize<T, std::underlying_type_t<T>, std::underlying_type_t<T>>
@@ -234,6 +707,16 @@ namespace serialize_impl
     : int_serialize<T, std::underlying_type_t<T>, Int>
     {};
 
+    template<typename T>
+    struct base_<T, false, true, false, varint>
+    : varint_serialize<T, std::underlying_type_t<T>, false>
+    {};
+
+    template<typename T>
+    struct base_<T, false, true, false, zigzag_varint>
+    : varint_serialize<T, std::underlying_type_t<T>, true>
+    {};
+
     template<typename T>
     struct base_<T, false, false, true>
     : base_<T, false, false, true, std::uint16_t>
@@ -243,35 +726,63 @@ namespace serialize_impl
     struct base_<T, false, false, true, SizeInt, P...>
     {
         using type = T;
+        using value_type = typename T::value_type;
+
+        // Vectors of integers are copied with a single bounds check
+        // and memcpy instead of element by element.
+        static constexpr bool bulk = (is_contiguous<T>::value 
+                                      && is_bulk_copyable<value_type, P...>
+                                         ::value);
+
+        using element = serialize<value_type, P...>;
+
+        static constexpr std::size_t min_size
+            = serialize_impl::min_size<serialize<std::size_t, SizeInt>>();
 
         template<typename It>
         static It read(It const begin, It const end, T& dest)
         {
             std::size_t size;
             auto it = serialize<std::size_t, SizeInt>::read(begin, end, size);
-            std::printf("size %lu\n", size);
-            dest.resize(size);
-            for(auto& v : dest)
-                it = serialize<typename T::value_type, P...>::read(it, end, v);
-            return it;
+            check_count(it, end, size, serialize_impl::min_size<element>());
+            read_budget_t::charge(size, sizeof(value_type));
+            if constexpr(bulk)
+            {
+                dest.resize(size);
+                return read_bytes(it, size * sizeof(value_type), dest.data());
+            }
+            else
+            {
+                dest.resize(size);
+                for(auto& v : dest)
+                    it = element::read(it, end, v);
+                return it;
+            }
         }
 
         template<typename It>
         static It write(T const& src, It const dest)
         {
             auto it = serialize<std::size_t, SizeInt>::write(src.size(), dest);
-            for(auto& v : src)
-                it = serialize<typename T::value_type, P...>::write(v, it);
-            std::printf("write size %lu\n", it-dest);
-            return it;
+            if constexpr(bulk)
+                return write_bytes(src.data(), src.size() * sizeof(value_type),
+                                   it);
+            else
+            {
+                for(auto& v : src)
+                    it = element::write(v, it);
+                return it;
+            }
         }
 
         static std::size_t size(T const& t)
         {
-            std::size_t size = serialize<std::size_t, SizeInt>::const_size;
-            for(auto& v : t)
-                size += serialize<typename T::value_type, P...>::size(v);
-            std::printf("size size %lu\n", size);
+            std::size_t size = serialize<std::size_t, SizeInt>::size(t.size());
+            if constexpr(bulk)
+                size += t.size() * sizeof(value_type);
+            else
+                for(auto& v : t)
+                    size += element::size(v);
             return size;
         }
     };
@@ -288,12 +799,101 @@ namespace serialize_impl
     template<typename T>
     using remove_first_t = typename remove_first<T>::type;
 
+    // Called through a function template so that structs which aren't
+    // fixed layout don't instantiate the members' read_unchecked.
+    template<typename S, typename It, typename T>
+    It read_unchecked(It const begin, T& dest)
+    {
+        return S::read_unchecked(begin, dest);
+    }
+
+    template<typename... Ts>
+    std::tuple<Ts&...> tie_members(std::nullptr_t, Ts&... members)
+    {
+        return std::tuple<Ts&...>(members...);
+    }
+
     template<typename T>
     struct add_params
     {
         template<typename... P>
         using type = serialize<T, P...>;
     };
+
+    // Members which are themselves SERIALIZED_DATA structs, serialized
+    // without parameters, are delta encoded recursively. Everything else
+    // is compared with == and written whole when it changes.
+    template<typename S, typename = void>
+    struct is_delta_struct : std::false_type {};
+
+    template<typename T>
+    struct is_delta_struct<serialize<T>,
+                           std::void_t<typename T::serialized_members>>
+    : std::true_type {};
+
+    template<typename S, typename T>
+    bool delta_equal(T const& a, T const& b)
+    {
+        if constexpr(is_delta_struct<S>::value)
+            return a.serialized_delta_mask(b) == 0;
+        else
+            return a == b;
+    }
+
+    template<typename S, typename It, typename T>
+    It write_delta(T const& src, T const& baseline, It const dest)
+    {
+        if constexpr(is_delta_struct<S>::value)
+            return src.write_serialized_delta(baseline, dest);
+        else
+            return S::write(src, dest);
+    }
+
+    template<typename S, typename It, typename T>
+    It read_delta(It const begin, It const end, T const& baseline, T& dest)
+    {
+        if constexpr(is_delta_struct<S>::value)
+            return dest.read_serialized_delta(baseline, begin, end);
+        else
+            return S::read(begin, end, dest);
+    }
+
+    template<typename S, typename T>
+    std::size_t delta_size(T const& src, T const& baseline)
+    {
+        if constexpr(is_delta_struct<S>::value)
+            return src.serialized_delta_size(baseline);
+        else
+            return S::size(src);
+    }
+
+    // The changed-members mask is written as ceil(N / 8) little endian
+    // bytes, where N is the number of members.
+    constexpr std::size_t delta_mask_size(std::size_t members)
+    {
+        return (members + 7) / 8;
+    }
+
+    template<typename It>
+    It write_delta_mask(std::uint64_t mask, std::size_t members, It it)
+    {
+        for(std::size_t i = 0; i != delta_mask_size(members); ++i, ++it)
+            *it = static_cast<char>(mask >> (i * 8));
+        return it;
+    }
+
+    template<typename It>
+    It read_delta_mask(It it, It const end, std::size_t members,
+                       std::uint64_t& mask)
+    {
+        check_range(it, end, delta_mask_size(members));
+        mask = 0;
+        for(std::size_t i = 0; i != delta_mask_size(members); ++i, ++it)
+            mask |= std::uint64_t((unsigned char)*it) << (i * 8);
+        if(members < 64 && mask >> members)
+            throw std::overflow_error("serialize::read overflow");
+        return it;
+    }
 }
 
 #define SERIALIZE_IMPL_GET(i, elem) \
@@ -310,6 +910,30 @@ SERIALIZE_IMPL_GET(0, elem) SERIALIZE_IMPL_GET(1, elem);
     it = S_::read(it, end, SERIALIZE_IMPL_GET(1, elem));\
 }
 
+#define SERIALIZE_IMPL_EXPAND_READ_SERIALIZED_UNCHECKED(r, it, elem) \
+{\
+    using S_ = ::serialize_impl::add_params<\
+        SERIALIZE_IMPL_GET(0, elem)>::template type<\
+        SERIALIZE_IMPL_GET(2, elem)>;\
+    it = ::serialize_impl::read_unchecked<S_>(it, SERIALIZE_IMPL_GET(1, elem));\
+}
+
+#define SERIALIZE_IMPL_EXPAND_READ_SERIALIZED_BITS(r, reader, elem) \
+{\
+    using S_ = ::serialize_impl::add_params<\
+        SERIALIZE_IMPL_GET(0, elem)>::template type<\
+        SERIALIZE_IMPL_GET(2, elem)>;\
+    ::serialize_impl::read_bits<S_>(reader, SERIALIZE_IMPL_GET(1, elem));\
+}
+
+#define SERIALIZE_IMPL_EXPAND_WRITE_SERIALIZED_BITS(r, writer, elem) \
+{\
+    using S_ = ::serialize_impl::add_params<\
+        SERIALIZE_IMPL_GET(0, elem)>::template type<\
+        SERIALIZE_IMPL_GET(2, elem)>;\
+    ::serialize_impl::write_bits<S_>(SERIALIZE_IMPL_GET(1, elem), writer);\
+}
+
 #define SERIALIZE_IMPL_EXPAND_WRITE_SERIALIZED(r, it, elem) \
 {\
     using S_ = ::serialize_impl::add_params<\
@@ -326,6 +950,52 @@ SERIALIZE_IMPL_GET(0, elem) SERIALIZE_IMPL_GET(1, elem);
     size += S_::size(SERIALIZE_IMPL_GET(1, elem));\
 }
 
+#define SERIALIZE_IMPL_EXPAND_SERIALIZED_DELTA_MASK(r, baseline, i, elem) \
+{\
+    using S_ = ::serialize_impl::add_params<\
+        SERIALIZE_IMPL_GET(0, elem)>::template type<\
+        SERIALIZE_IMPL_GET(2, elem)>;\
+    if(!::serialize_impl::delta_equal<S_>(SERIALIZE_IMPL_GET(1, elem),\
+                                         baseline.SERIALIZE_IMPL_GET(1, elem)))\
+        mask |= std::uint64_t(1) << i;\
+}
+
+#define SERIALIZE_IMPL_EXPAND_READ_SERIALIZED_DELTA(r, it, i, elem) \
+if(mask & (std::uint64_t(1) << i))\
+{\
+    using S_ = ::serialize_impl::add_params<\
+        SERIALIZE_IMPL_GET(0, elem)>::template type<\
+        SERIALIZE_IMPL_GET(2, elem)>;\
+    it = ::serialize_impl::read_delta<S_>(it, end,\
+                                          baseline.SERIALIZE_IMPL_GET(1, elem),\
+                                          SERIALIZE_IMPL_GET(1, elem));\
+}\
+else\
+    SERIALIZE_IMPL_GET(1, elem) = baseline.SERIALIZE_IMPL_GET(1, elem);
+
+#define SERIALIZE_IMPL_EXPAND_WRITE_SERIALIZED_DELTA(r, it, i, elem) \
+if(mask & (std::uint64_t(1) << i))\
+{\
+    using S_ = ::serialize_impl::add_params<\
+        SERIALIZE_IMPL_GET(0, elem)>::template type<\
+        SERIALIZE_IMPL_GET(2, elem)>;\
+    it = ::serialize_impl::write_delta<S_>(\
+        SERIALIZE_IMPL_GET(1, elem), baseline.SERIALIZE_IMPL_GET(1, elem), it);\
+}
+
+#define SERIALIZE_IMPL_EXPAND_SERIALIZED_DELTA_SIZE(r, data, i, elem) \
+if(mask & (std::uint64_t(1) << i))\
+{\
+    using S_ = ::serialize_impl::add_params<\
+        SERIALIZE_IMPL_GET(0, elem)>::template type<\
+        SERIALIZE_IMPL_GET(2, elem)>;\
+    size += ::serialize_impl::delta_size<S_>(\
+        SERIALIZE_IMPL_GET(1, elem), baseline.SERIALIZE_IMPL_GET(1, elem));\
+}
+
+#define SERIALIZE_IMPL_EXPAND_SERIALIZED_TIE(r, data, elem) \
+, SERIALIZE_IMPL_GET(1, elem)
+
 #define SERIALIZE_IMPL_EXPAND_SERIALIZED_TYPE_LIST(r, data, elem) \
 , serialize_impl::add_params<SERIALIZE_IMPL_GET(0, elem)>\
   ::template type<SERIALIZE_IMPL_GET(2, elem)>
@@ -333,10 +1003,31 @@ SERIALIZE_IMPL_GET(0, elem) SERIALIZE_IMPL_GET(1, elem);
 // Use this macro in a struct to get some serialization functions 
 // defined for it. Pass in a PP sequence of 2-tuples for member variables.
 // The functions are:
-//   InputIt read_serialized(InputIt)
+//   InputIt read_serialized(InputIt, InputIt)
+//   InputIt read_serialized_unchecked(InputIt)
 //   OutputIt write_serialized(OutputIt) const
 //   std::size_t serialized_size() const
-//   
+//   void read_serialized_bits(BitReader&)
+//   void write_serialized_bits(BitWriter&) const
+//
+//   InputIt read_serialized_delta(T const& baseline, InputIt, InputIt)
+//   OutputIt write_serialized_delta(T const& baseline, OutputIt) const
+//   std::size_t serialized_delta_size(T const& baseline) const
+//   std::uint64_t serialized_delta_mask(T const& baseline) const
+//   std::tuple<Ms&...> serialized_tie()
+//   std::tuple<Ms const&...> serialized_tie() const
+//
+// read_serialized_unchecked does no bounds checking and is only usable
+// when every member has a compile-time size; 'serialize' calls it after
+// checking the size of the whole struct at once.
+// The _bits functions implement serialize<T, bit_packed>; see
+// bit_serialize.hpp.
+// The _delta functions encode the struct against a baseline which the
+// reader already has: a bitmask of the members that differ from the
+// baseline, followed by only those members. Members which are themselves
+// SERIALIZED_DATA structs are delta encoded recursively; other members are
+// compared with ==. They're exposed as serialize<T>::write_delta,
+// read_delta and delta_size. Structs may have at most 64 members.
 //
 // Example:
 //  struct foo
@@ -358,6 +1049,14 @@ InputIt read_serialized(InputIt begin, InputIt end)\
     BOOST_PP_SEQ_FOR_EACH(SERIALIZE_IMPL_EXPAND_READ_SERIALIZED, it, memseq)\
     return it;\
 }\
+template<typename InputIt>\
+InputIt read_serialized_unchecked(InputIt begin)\
+{\
+    auto it = begin;\
+    BOOST_PP_SEQ_FOR_EACH(SERIALIZE_IMPL_EXPAND_READ_SERIALIZED_UNCHECKED,\
+                          it, memseq)\
+    return it;\
+}\
 template<typename OutputIt>\
 OutputIt write_serialized(OutputIt dest) const\
 {\
@@ -365,12 +1064,75 @@ OutputIt write_serialized(OutputIt dest) const\
     BOOST_PP_SEQ_FOR_EACH(SERIALIZE_IMPL_EXPAND_WRITE_SERIALIZED, it, memseq)\
     return it;\
 }\
+template<typename BitReader>\
+void read_serialized_bits(BitReader& reader)\
+{\
+    BOOST_PP_SEQ_FOR_EACH(SERIALIZE_IMPL_EXPAND_READ_SERIALIZED_BITS,\
+                          reader, memseq)\
+}\
+template<typename BitWriter>\
+void write_serialized_bits(BitWriter& writer) const\
+{\
+    BOOST_PP_SEQ_FOR_EACH(SERIALIZE_IMPL_EXPAND_WRITE_SERIALIZED_BITS,\
+                          writer, memseq)\
+}\
 std::size_t serialized_size() const\
 {\
     std::size_t size = 0;\
     BOOST_PP_SEQ_FOR_EACH(SERIALIZE_IMPL_EXPAND_SERIALIZED_SIZE,, memseq);\
     return size;\
 }\
+template<typename Self>\
+std::uint64_t serialized_delta_mask(Self const& baseline) const\
+{\
+    static_assert(std::tuple_size<serialized_members>::value <= 64,\
+                  "delta encoding supports at most 64 members");\
+    std::uint64_t mask = 0;\
+    BOOST_PP_SEQ_FOR_EACH_I(SERIALIZE_IMPL_EXPAND_SERIALIZED_DELTA_MASK,\
+                            baseline, memseq)\
+    return mask;\
+}\
+template<typename Self, typename InputIt>\
+InputIt read_serialized_delta(Self const& baseline,\
+                              InputIt begin, InputIt end)\
+{\
+    std::uint64_t mask;\
+    auto it = ::serialize_impl::read_delta_mask(\
+        begin, end, std::tuple_size<serialized_members>::value, mask);\
+    BOOST_PP_SEQ_FOR_EACH_I(SERIALIZE_IMPL_EXPAND_READ_SERIALIZED_DELTA,\
+                            it, memseq)\
+    return it;\
+}\
+template<typename Self, typename OutputIt>\
+OutputIt write_serialized_delta(Self const& baseline, OutputIt dest) const\
+{\
+    std::uint64_t const mask = serialized_delta_mask(baseline);\
+    auto it = ::serialize_impl::write_delta_mask(\
+        mask, std::tuple_size<serialized_members>::value, dest);\
+    BOOST_PP_SEQ_FOR_EACH_I(SERIALIZE_IMPL_EXPAND_WRITE_SERIALIZED_DELTA,\
+                            it, memseq)\
+    return it;\
+}\
+template<typename Self>\
+std::size_t serialized_delta_size(Self const& baseline) const\
+{\
+    std::uint64_t const mask = serialized_delta_mask(baseline);\
+    std::size_t size = ::serialize_impl::delta_mask_size(\
+        std::tuple_size<serialized_members>::value);\
+    BOOST_PP_SEQ_FOR_EACH_I(SERIALIZE_IMPL_EXPAND_SERIALIZED_DELTA_SIZE,,\
+                            memseq)\
+    return size;\
+}\
+auto serialized_tie()\
+{\
+    return ::serialize_impl::tie_members(nullptr\
+        BOOST_PP_SEQ_FOR_EACH(SERIALIZE_IMPL_EXPAND_SERIALIZED_TIE,, memseq));\
+}\
+auto serialized_tie() const\
+{\
+    return ::serialize_impl::tie_members(nullptr\
+        BOOST_PP_SEQ_FOR_EACH(SERIALIZE_IMPL_EXPAND_SERIALIZED_TIE,, memseq));\
+}\
 using serialized_members = serialize_impl::remove_first_t<std::tuple<void\
     BOOST_PP_SEQ_FOR_EACH(SERIALIZE_IMPL_EXPAND_SERIALIZED_TYPE_LIST,,\
                           memseq)>>;
@@ -0,0 +1,62 @@
+#ifndef SERIALIZE_TEST_TYPES_HPP
+#define SERIALIZE_TEST_TYPES_HPP
+
+// Structs exercising most of SERIALIZED_DATA, shared by the serialize
+// tests and benchmarks.
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include <eggs/variant.hpp>
+
+#include "serialize.hpp"
+
+struct foo_t
+{
+    SERIALIZED_DATA
+    (
+        ((std::int8_t)   (x) ())
+        ((std::int16_t)  (y) (std::int64_t))
+        ((std::uint32_t) (z) (std::uint64_t))
+    )
+
+    bool operator==(foo_t const& o) const
+    {
+        return x == o.x && y == o.y && z == o.z;
+    }
+
+    bool operator!=(foo_t const& o) const
+    {
+        return !(*this == o);
+    }
+};
+
+struct bar_t
+{
+    SERIALIZED_DATA
+    (
+        ((foo_t)                (foo1) ())
+        ((std::uint64_t)        (x)    ())
+        ((bool)                 (y)    ())
+        ((foo_t)                (foo2) ())
+        ((std::vector<int>)     (vec)  (std::uint8_t, std::int16_t))
+        ((std::array<short, 8>) (arr)  (std::int64_t))
+        ((eggs::variant<int>)   (v)    ())
+    )
+    bool operator==(bar_t const& o) const
+    {
+        return (foo1 == o.foo1 && x == o.x && y == o.y && foo2 == o.foo2
+                && std::equal(vec.begin(), vec.end(), o.vec.begin())
+                && arr == o.arr
+                && v == o.v);
+    }
+
+    bool operator!=(bar_t const& o) const
+    {
+        return !(*this == o);
+    }
+};
+
+#endif
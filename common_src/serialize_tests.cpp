@@ -3,63 +3,26 @@
 #include <catch/catch.hpp>
 
 #include <array>
+#include <cmath>
 #include <cstdint>
-#include <iostream>
+#include <deque>
+#include <memory_resource>
+#include <numeric>
 
 #include <arpa/inet.h>
 
+#include "arena.hpp"
+#include "bounded_sink.hpp"
 #include "buffer.hpp"
+#include "game.hpp"
+#include "net.hpp"
+#include "serialize_test_types.hpp"
+#include "shared_view.hpp"
 
 #include <boost/preprocessor/seq/variadic_seq_to_seq.hpp>
 
 #include <eggs/variant.hpp>
 
-struct foo_t
-{
-    SERIALIZED_DATA
-    (
-        ((std::int8_t)   (x) ())
-        ((std::int16_t)  (y) (std::int64_t))
-        ((std::uint32_t) (z) (std::uint64_t))
-    )
-
-    bool operator==(foo_t const& o) const
-    {
-        return x == o.x && y == o.y && z == o.z;
-    }
-
-    bool operator!=(foo_t const& o) const
-    {
-        return !(*this == o);
-    }
-};
-
-struct bar_t
-{
-    SERIALIZED_DATA
-    (
-        ((foo_t)                (foo1) ())
-        ((std::uint64_t)        (x)    ())
-        ((bool)                 (y)    ())
-        ((foo_t)                (foo2) ())
-        ((std::vector<int>)     (vec)  (std::uint8_t, std::int16_t))
-        ((std::array<short, 8>) (arr)  (std::int64_t))
-        ((eggs::variant<int>)   (v)    ())
-    )
-    bool operator==(bar_t const& o) const
-    {
-        return (foo1 == o.foo1 && x == o.x && y == o.y && foo2 == o.foo2
-                && std::equal(vec.begin(), vec.end(), o.vec.begin())
-                && arr == o.arr
-                && v == o.v);
-    }
-
-    bool operator!=(bar_t const& o) const
-    {
-        return !(*this == o);
-    }
-};
-
 struct qux_t
 {
     SERIALIZED_DATA
@@ -85,6 +48,12 @@ TEST_CASE("SERIALIZED_DATA", "[serialize]")
         serialize<foo_t>::read(buffer.begin(), buffer.end(), foo2);
 
         REQUIRE(foo1 == foo2);
+
+        // foo_t is fixed layout, so it's bounds checked all at once.
+        REQUIRE(serialize<foo_t>::fixed_layout);
+        REQUIRE_THROWS_AS(
+            serialize<foo_t>::read(buffer.begin(), buffer.end() - 1, foo2),
+            std::range_error);
     }
 
     SECTION("bar_t")
@@ -95,6 +64,7 @@ TEST_CASE("SERIALIZED_DATA", "[serialize]")
         bar_t bar2 = {};
 
         REQUIRE(bar1 != bar2);
+        REQUIRE(!serialize<bar_t>::fixed_layout);
 
         std::vector<char> buffer(serialize<bar_t>::size(bar1));
         serialize<bar_t>::write(bar1, buffer.begin());
@@ -110,7 +80,1036 @@ TEST_CASE("SERIALIZED_DATA", "[serialize]")
                 == sizeof(std::uint8_t) + sizeof(std::uint16_t) * 4);
     }
 
+    SECTION("update_object_position_t")
+    {
+        // The per-tick position update takes the fixed layout path.
+        // Other updates have varint ids, and are checked field by field.
+        using position_serialize = serialize<update_object_position_t>;
+        REQUIRE(position_serialize::fixed_layout);
+        REQUIRE(position_serialize::const_size
+                == sizeof(object_id_t) + serialize<coord_t>::const_size);
+        REQUIRE(!serialize<update_create_object_t>::fixed_layout);
+
+        update_object_position_t const update = { 1234, { 5, -6 } };
+        std::vector<char> buffer(position_serialize::const_size);
+        position_serialize::write(update, buffer.begin());
+
+        update_object_position_t result;
+        position_serialize::read(buffer.begin(), buffer.end(), result);
+        REQUIRE(result.object_id == update.object_id);
+        REQUIRE(result.position == update.position);
+        REQUIRE_THROWS_AS(
+            position_serialize::read(buffer.begin(), buffer.end() - 1,
+                                     result),
+            std::range_error);
+    }
+
     REQUIRE((serialize<long long, std::uint16_t>::const_size == 2));
     REQUIRE((serialize<char, std::uint32_t>::const_size == 4));
 }
 
+
+TEST_CASE("bulk copied lists", "[serialize]")
+{
+    std::vector<std::int32_t> vec(1000);
+    std::iota(vec.begin(), vec.end(), -500);
+    std::deque<std::int32_t> deq(vec.begin(), vec.end());
+
+    using vec_serialize = serialize<std::vector<std::int32_t>>;
+    using deq_serialize = serialize<std::deque<std::int32_t>>;
+
+    REQUIRE(vec_serialize::bulk);
+    REQUIRE(!deq_serialize::bulk);
+    REQUIRE(!(serialize<std::vector<int>, std::uint8_t, std::int16_t>::bulk));
+    REQUIRE(vec_serialize::size(vec) == deq_serialize::size(deq));
+
+    // Both paths must produce identical bytes.
+    std::vector<char> vec_buffer(vec_serialize::size(vec));
+    std::vector<char> deq_buffer(deq_serialize::size(deq));
+    vec_serialize::write(vec, vec_buffer.begin());
+    deq_serialize::write(deq, deq_buffer.begin());
+    REQUIRE(vec_buffer == deq_buffer);
+
+    std::vector<std::int32_t> vec2;
+    vec_serialize::read(vec_buffer.cbegin(), vec_buffer.cend(), vec2);
+    REQUIRE(vec == vec2);
+
+    std::array<std::uint16_t, 4> arr = {{ 1, 2, 3, 0xFFFF }};
+    std::array<std::uint16_t, 4> arr2 = {};
+    std::array<char, 8> arr_buffer;
+    REQUIRE(serialize<std::array<std::uint16_t, 4>>::bulk);
+    serialize<std::array<std::uint16_t, 4>>::write(arr, arr_buffer.begin());
+    serialize<std::array<std::uint16_t, 4>>::read(
+        arr_buffer.cbegin(), arr_buffer.cend(), arr2);
+    REQUIRE(arr == arr2);
+
+    REQUIRE_THROWS_AS(
+        vec_serialize::read(vec_buffer.cbegin(), vec_buffer.cend() - 1, vec2),
+        std::range_error);
+}
+
+TEST_CASE("endian", "[serialize]")
+{
+    // Pointers take the single load and store path, while other
+    // iterators are converted a byte at a time. Both must agree.
+    std::uint64_t const u64 = 0x0102030405060708ull;
+    std::int16_t const i16 = -2;
+
+    char bytes[10];
+    to_little_endian(u64, bytes);
+    to_big_endian(i16, bytes + 8);
+    REQUIRE(bytes[0] == 8);
+    REQUIRE(bytes[7] == 1);
+    REQUIRE(bytes[8] == char(0xFF));
+    REQUIRE(bytes[9] == char(0xFE));
+
+    std::deque<char> deq(10);
+    to_little_endian(u64, deq.begin());
+    to_big_endian(i16, deq.begin() + 8);
+    REQUIRE(std::equal(deq.begin(), deq.end(), bytes));
+
+    std::uint64_t u64_ptr, u64_it;
+    std::int16_t i16_ptr, i16_it;
+    char const* const p = bytes;
+    REQUIRE(from_little_endian(p, u64_ptr) == p + 8);
+    from_big_endian(p + 8, i16_ptr);
+    from_little_endian(deq.begin(), u64_it);
+    from_big_endian(deq.begin() + 8, i16_it);
+    REQUIRE(u64_ptr == u64);
+    REQUIRE(u64_it == u64);
+    REQUIRE(i16_ptr == i16);
+    REQUIRE(i16_it == i16);
+}
+
+template<typename S, typename T>
+static std::vector<char> write_to_vector(T const& t)
+{
+    std::vector<char> buffer(S::size(t));
+    REQUIRE(S::write(t, buffer.begin()) == buffer.end());
+    return buffer;
+}
+
+template<typename S, typename T>
+static T roundtrip(T const& t)
+{
+    std::vector<char> buffer = write_to_vector<S>(t);
+    T result{};
+    REQUIRE(S::read(buffer.cbegin(), buffer.cend(), result) == buffer.cend());
+    return result;
+}
+
+TEST_CASE("varint", "[serialize]")
+{
+    using u32_varint = serialize<std::uint32_t, varint>;
+    using i32_zigzag = serialize<std::int32_t, zigzag_varint>;
+
+    REQUIRE(u32_varint::max_size == 5);
+    REQUIRE(u32_varint::size(0) == 1);
+    REQUIRE(u32_varint::size(127) == 1);
+    REQUIRE(u32_varint::size(128) == 2);
+    REQUIRE(u32_varint::size(16383) == 2);
+    REQUIRE(u32_varint::size(16384) == 3);
+    REQUIRE(u32_varint::size(UINT32_MAX) == 5);
+
+    REQUIRE(i32_zigzag::size(0) == 1);
+    REQUIRE(i32_zigzag::size(-1) == 1);
+    REQUIRE(i32_zigzag::size(63) == 1);
+    REQUIRE(i32_zigzag::size(-64) == 1);
+    REQUIRE(i32_zigzag::size(64) == 2);
+    REQUIRE(i32_zigzag::size(INT32_MIN) == 5);
+
+    for(std::uint32_t v : { 0u, 1u, 127u, 128u, 300u, 16384u, UINT32_MAX })
+        REQUIRE(roundtrip<u32_varint>(v) == v);
+
+    for(std::int32_t v : { 0, -1, 1, -64, 64, -300, INT32_MIN, INT32_MAX })
+        REQUIRE(roundtrip<i32_zigzag>(v) == v);
+
+    REQUIRE(write_to_vector<u32_varint>(300u) 
+            == (std::vector<char>{ char(0xAC), 0x02 }));
+
+    std::uint32_t u32;
+    std::uint8_t u8;
+
+    // Truncated input.
+    std::vector<char> const truncated = { char(0xAC) };
+    REQUIRE_THROWS_AS(
+        u32_varint::read(truncated.cbegin(), truncated.cend(), u32),
+        std::range_error);
+
+    // Too many bytes, and values which don't fit the destination type.
+    std::vector<char> const too_long(6, char(0x80));
+    REQUIRE_THROWS_AS(
+        u32_varint::read(too_long.cbegin(), too_long.cend(), u32),
+        std::overflow_error);
+    std::vector<char> const too_big = { char(0xAC), 0x02 };
+    REQUIRE_THROWS_AS(
+        (serialize<std::uint8_t, varint>::read(
+            too_big.cbegin(), too_big.cend(), u8)),
+        std::overflow_error);
+}
+
+enum class packed_enum_t : std::uint8_t { a, b, c, d };
+
+struct packed_t
+{
+    SERIALIZED_DATA
+    (
+        ((packed_enum_t) (e)    (bits<2>))
+        ((bool)          (flag) ())
+        ((std::int16_t)  (dx)   (bits<5>))
+        ((std::uint64_t) (big)  ())
+        ((int2d::coord_t) (pos) (bits<4>))
+    )
+
+    bool operator==(packed_t const& o) const
+    {
+        return (e == o.e && flag == o.flag && dx == o.dx && big == o.big
+                && pos == o.pos);
+    }
+};
+
+TEST_CASE("bit_packed", "[serialize]")
+{
+    using packed_serialize = serialize<packed_t, bit_packed>;
+
+    REQUIRE(packed_serialize::const_size == (2 + 1 + 5 + 64 + 8 + 7) / 8);
+
+    for(packed_t packed : 
+        { packed_t{ packed_enum_t::d, true, -16, UINT64_MAX, { -8, 7 } },
+          packed_t{ packed_enum_t::b, false, 15, 0x123456789ull, { 0, 0 } } })
+    {
+        REQUIRE(roundtrip<packed_serialize>(packed) == packed);
+    }
+
+    // Byte-aligned serialization rounds bits<N> up to whole bytes.
+    REQUIRE(serialize<packed_t>::const_size == 1 + 1 + 1 + 8 + 2);
+    packed_t packed = { packed_enum_t::c, true, -3, 42, { 1, -1 } };
+    REQUIRE(roundtrip<serialize<packed_t>>(packed) == packed);
+
+    std::vector<char> buffer(packed_serialize::const_size);
+    packed.dx = 16;
+    REQUIRE_THROWS_AS(packed_serialize::write(packed, buffer.begin()),
+                      std::overflow_error);
+    packed.dx = -3;
+
+    packed_serialize::write(packed, buffer.begin());
+    REQUIRE_THROWS_AS(
+        packed_serialize::read(buffer.cbegin(), buffer.cend() - 1, packed),
+        std::range_error);
+
+    // Byte-aligned bits<N> accepts the same values as bit packed.
+    std::vector<char> aligned(serialize<packed_t>::const_size);
+    packed.dx = 16;
+    REQUIRE_THROWS_AS(serialize<packed_t>::write(packed, aligned.begin()),
+                      std::overflow_error);
+    packed.dx = -17;
+    REQUIRE_THROWS_AS(serialize<packed_t>::write(packed, aligned.begin()),
+                      std::overflow_error);
+    packed.dx = -16;
+    serialize<packed_t>::write(packed, aligned.begin());
+    aligned[2] = 16; // dx, as an std::int8_t.
+    REQUIRE_THROWS_AS(
+        serialize<packed_t>::read(aligned.cbegin(), aligned.cend(), packed),
+        std::overflow_error);
+    packed.dx = -3;
+
+    // 16 + 16 + 3 bits.
+    REQUIRE(serialize<cts_udp_message_t, bit_packed>::const_size == 5);
+    cts_udp_message_t message = { { 1234, 5678 }, { CTS_INPUT_RIGHT } };
+    cts_udp_message_t message2 = 
+        roundtrip<serialize<cts_udp_message_t, bit_packed>>(message);
+    REQUIRE(message2.header.sequence_number == 1234);
+    REQUIRE(message2.header.last_received_time == 5678);
+    REQUIRE(message2.body.input == CTS_INPUT_RIGHT);
+}
+
+TEST_CASE("read_bit_array", "[serialize]")
+{
+    // Long enough for whole groups of eight, single values and a tail.
+    for(unsigned width = 1; width <= 64; ++width)
+    {
+        for(std::size_t n : { 0, 1, 7, 8, 9, 17, 100 })
+        {
+            std::vector<std::uint64_t> values(n);
+            for(std::size_t i = 0; i != n; ++i)
+            {
+                values[i] = (i + 1) * 0x9e3779b97f4a7c15ull
+                          >> (64 - width);
+            }
+
+            std::vector<char> buffer((n * width + 7) / 8);
+            bit_writer<std::vector<char>::iterator> writer(buffer.begin());
+            for(std::uint64_t v : values)
+                writer.write(v, width);
+            REQUIRE(writer.finish() == buffer.end());
+
+            std::vector<std::uint64_t> read;
+            auto const push = [&](std::uint64_t v) { read.push_back(v); };
+            REQUIRE(read_bit_array(buffer.cbegin(), buffer.cend(),
+                                   width, n, push) == buffer.cend());
+            REQUIRE(read == values);
+
+            // Not contiguous, so read through bit_reader.
+            std::deque<char> const deque(buffer.begin(), buffer.end());
+            read.clear();
+            REQUIRE(read_bit_array(deque.cbegin(), deque.cend(),
+                                   width, n, push) == deque.cend());
+            REQUIRE(read == values);
+
+            if(n)
+            {
+                REQUIRE_THROWS_AS(
+                    read_bit_array(buffer.cbegin(), buffer.cend() - 1,
+                                   width, n, push),
+                    std::range_error);
+            }
+        }
+    }
+}
+
+struct owned_t
+{
+    SERIALIZED_DATA
+    (
+        ((std::string)                 (name) ())
+        ((std::vector<std::int32_t>)   (ids)  ())
+    )
+};
+
+struct viewed_t
+{
+    SERIALIZED_DATA
+    (
+        ((shared_string_view_t)             (name) ())
+        ((shared_int_span_t<std::int32_t>)  (ids)  ())
+    )
+};
+
+TEST_CASE("shared_buffer_t views", "[serialize]")
+{
+    owned_t owned = { "hello", { 1, -2, 300000, -400000 } };
+    viewed_t viewed;
+    {
+        shared_buffer_t buffer(serialize<owned_t>::size(owned));
+        serialize<owned_t>::write(owned, buffer.begin());
+
+        auto it = serialize<viewed_t>::read(buffer.view_begin(),
+                                            buffer.view_end(), viewed);
+        REQUIRE(it == buffer.view_end());
+        REQUIRE(viewed.name.data() == buffer.data() + 0);
+        REQUIRE_THROWS_AS(
+            serialize<viewed_t>::read(buffer.view_begin(),
+                                      buffer.view_end() - 1, viewed),
+            std::range_error);
+    }
+
+    // The views keep the buffer alive after it goes out of scope.
+    REQUIRE(viewed.name.view() == "hello");
+    REQUIRE(viewed.ids.size() == 4);
+    REQUIRE(std::vector<std::int32_t>(viewed.ids.begin(), viewed.ids.end())
+            == owned.ids);
+    REQUIRE(viewed.ids[2] == 300000);
+    REQUIRE_THROWS_AS(viewed.ids.at(4), std::out_of_range);
+
+    // Views write the same format as the types they view.
+    std::vector<char> bytes = write_to_vector<serialize<viewed_t>>(viewed);
+    owned_t owned2;
+    serialize<owned_t>::read(bytes.cbegin(), bytes.cend(), owned2);
+    REQUIRE(owned2.name == owned.name);
+    REQUIRE(owned2.ids == owned.ids);
+}
+
+TEST_CASE("buffer_sink_t", "[serialize]")
+{
+    owned_t owned = { std::string(300, 'a'), std::vector<std::int32_t>(99) };
+    std::iota(owned.ids.begin(), owned.ids.end(), -50);
+
+    // A tiny initial capacity forces the sink to grow several times.
+    buffer_sink_t sink(1);
+    serialize<owned_t>::write(owned, sink.out());
+    REQUIRE(sink.size() == serialize<owned_t>::size(owned));
+    REQUIRE(sink.capacity() >= sink.size());
+
+    std::vector<char> const expected = write_to_vector<serialize<owned_t>>(
+        owned);
+    shared_buffer_t buffer = sink.release();
+    REQUIRE(sink.size() == 0);
+    REQUIRE(std::vector<char>(buffer.begin(), buffer.end()) == expected);
+
+    // The sink can be reused after release.
+    std::deque<std::int16_t> deq = { 1, -2, 3 };
+    serialize<std::deque<std::int16_t>>::write(deq, sink.out());
+    REQUIRE(sink.size() == serialize<std::deque<std::int16_t>>::size(deq));
+}
+
+struct fractional_t
+{
+    SERIALIZED_DATA
+    (
+        ((float)  (sub_x) (quantized<0, 1, 8>))
+        ((double) (vel)   (quantized<-16, 16, 12>))
+        ((bool)   (flag)  ())
+    )
+};
+
+TEST_CASE("quantized", "[serialize]")
+{
+    using unit_serialize = serialize<float, quantized<0, 1, 8>>;
+    using vel_serialize = serialize<double, quantized<-16, 16, 12>>;
+
+    REQUIRE(unit_serialize::const_size == 1);
+    REQUIRE(vel_serialize::const_size == 2);
+
+    for(float f = 0.0f; f <= 1.0f; f += 0.001f)
+    {
+        float const result = roundtrip<unit_serialize>(f);
+        REQUIRE(std::abs(result - f) <= 0.5f / 255.0f + 1e-6f);
+    }
+    REQUIRE(roundtrip<unit_serialize>(0.0f) == 0.0f);
+    REQUIRE(roundtrip<unit_serialize>(1.0f) == 1.0f);
+    REQUIRE(roundtrip<vel_serialize>(-16.0) == -16.0);
+    REQUIRE(roundtrip<vel_serialize>(16.0) == 16.0);
+    REQUIRE(std::abs(roundtrip<vel_serialize>(3.14159) - 3.14159)
+            <= quantized<-16, 16, 12>::step / 2);
+
+    std::vector<char> buffer(2);
+    REQUIRE_THROWS_AS(unit_serialize::write(1.01f, buffer.begin()),
+                      std::overflow_error);
+    REQUIRE_THROWS_AS(unit_serialize::write(NAN, buffer.begin()),
+                      std::overflow_error);
+
+    // 12 bits stored in 2 bytes leaves values which are out of range.
+    buffer = { char(0xFF), char(0xFF) };
+    double d;
+    REQUIRE_THROWS_AS(vel_serialize::read(buffer.cbegin(), buffer.cend(), d),
+                      std::overflow_error);
+
+    using packed_serialize = serialize<fractional_t, bit_packed>;
+    REQUIRE(serialize<fractional_t>::const_size == 1 + 2 + 1);
+    REQUIRE(packed_serialize::const_size == (8 + 12 + 1 + 7) / 8);
+
+    fractional_t fractional = { 0.5f, -2.5, true };
+    fractional_t result = roundtrip<packed_serialize>(fractional);
+    REQUIRE(std::abs(result.sub_x - 0.5f) <= 0.5f / 255.0f + 1e-6f);
+    REQUIRE(std::abs(result.vel + 2.5) <= quantized<-16, 16, 12>::step / 2);
+    REQUIRE(result.flag);
+}
+
+TEST_CASE("hostile sizes", "[serialize]")
+{
+    using vec_serialize = serialize<std::vector<std::int64_t>, std::uint32_t>;
+    using str_vec_serialize
+        = serialize<std::vector<std::string>, std::uint32_t>;
+
+    // A size claiming 2^32-1 elements, followed by a few bytes.
+    std::vector<char> const buffer = { char(0xFF), char(0xFF), char(0xFF),
+                                       char(0xFF), 'a', '\0', 'b', '\0' };
+
+    SECTION("size larger than the remaining bytes could hold")
+    {
+        std::vector<std::int64_t> vec;
+        REQUIRE_THROWS_AS(
+            vec_serialize::read(buffer.cbegin(), buffer.cend(), vec),
+            std::range_error);
+        REQUIRE(vec.capacity() == 0);
+
+        // Strings take at least 1 byte each, so 4 strings could fit.
+        std::vector<std::string> strs;
+        REQUIRE_THROWS_AS(
+            str_vec_serialize::read(buffer.cbegin(), buffer.cend(), strs),
+            std::range_error);
+        REQUIRE(strs.capacity() == 0);
+
+        REQUIRE(serialize_impl::min_size<serialize<std::string>>() == 1);
+        REQUIRE(serialize_impl::min_size<serialize<owned_t>>() == 1 + 2);
+        REQUIRE(serialize_impl::min_size<serialize<diff_t>>() == 1 + 1);
+    }
+
+    SECTION("read budget")
+    {
+        std::vector<std::int32_t> const vec(100);
+        std::vector<char> const bytes
+            = write_to_vector<serialize<std::vector<std::int32_t>>>(vec);
+
+        std::vector<std::int32_t> result;
+        {
+            read_budget_t budget(100 * sizeof(std::int32_t) - 1);
+            REQUIRE_THROWS_AS(
+                serialize<std::vector<std::int32_t>>::read(
+                    bytes.cbegin(), bytes.cend(), result),
+                std::length_error);
+        }
+
+        read_budget_t outer(1000);
+        {
+            read_budget_t inner(1000000);
+            serialize<std::vector<std::int32_t>>::read(
+                bytes.cbegin(), bytes.cend(), result);
+            REQUIRE(inner.remaining() == 1000000 - 400);
+        }
+        REQUIRE(outer.remaining() == 600);
+
+        // The inner budget can't spend more than the outer has left.
+        read_budget_t inner(1000000);
+        serialize<std::vector<std::int32_t>>::read(
+            bytes.cbegin(), bytes.cend(), result);
+        REQUIRE(outer.remaining() == 200);
+        REQUIRE_THROWS_AS(
+            serialize<std::vector<std::int32_t>>::read(
+                bytes.cbegin(), bytes.cend(), result),
+            std::length_error);
+
+        std::string str;
+        std::vector<char> const str_bytes
+            = write_to_vector<serialize<std::string>>(std::string(201, 'x'));
+        REQUIRE_THROWS_AS(
+            serialize<std::string>::read(str_bytes.cbegin(), str_bytes.cend(),
+                                         str),
+            std::length_error);
+    }
+
+    SECTION("unterminated string")
+    {
+        std::string str;
+        REQUIRE_THROWS_AS(
+            serialize<std::string>::read(buffer.cbegin(), buffer.cbegin() + 5,
+                                         str),
+            std::range_error);
+    }
+}
+
+TEST_CASE("strings", "[serialize]")
+{
+    std::string const with_nul("ab\0cd", 5);
+
+    SECTION("NUL-terminated")
+    {
+        REQUIRE(roundtrip<serialize<std::string>>(std::string("hello"))
+                == "hello");
+        REQUIRE(roundtrip<serialize<std::string>>(std::string()).empty());
+
+        // Non-contiguous input is scanned without memchr.
+        std::deque<char> const deq = { 'h', 'i', '\0' };
+        std::string str;
+        REQUIRE(serialize<std::string>::read(deq.begin(), deq.end(), str)
+                == deq.end());
+        REQUIRE(str == "hi");
+
+        std::vector<char> const buffer = { 'a', 'b', 'c' };
+        REQUIRE_THROWS_AS(
+            serialize<std::string>::read(buffer.cbegin(), buffer.cend(), str),
+            std::range_error);
+    }
+
+    SECTION("length-prefixed")
+    {
+        using u8_serialize = serialize<std::string, std::uint8_t>;
+        using varint_serialize = serialize<std::string, varint>;
+
+        REQUIRE(u8_serialize::size(with_nul) == 1 + 5);
+        REQUIRE(roundtrip<u8_serialize>(with_nul) == with_nul);
+        REQUIRE(roundtrip<varint_serialize>(std::string()).empty());
+
+        std::string const long_str(300, 'z');
+        REQUIRE(varint_serialize::size(long_str) == 2 + 300);
+        REQUIRE(roundtrip<varint_serialize>(long_str) == long_str);
+
+        std::vector<char> buffer(u8_serialize::size(with_nul));
+        REQUIRE_THROWS_AS(u8_serialize::write(long_str, buffer.begin()),
+                          std::overflow_error);
+
+        u8_serialize::write(with_nul, buffer.begin());
+        std::string str;
+        REQUIRE_THROWS_AS(
+            u8_serialize::read(buffer.cbegin(), buffer.cend() - 1, str),
+            std::range_error);
+
+        std::deque<char> const deq(buffer.begin(), buffer.end());
+        REQUIRE(u8_serialize::read(deq.begin(), deq.end(), str) == deq.end());
+        REQUIRE(str == with_nul);
+    }
+
+    SECTION("views")
+    {
+        using view_serialize = serialize<shared_string_view_t, varint>;
+
+        shared_buffer_t buffer(serialize<std::string, varint>::size(with_nul));
+        serialize<std::string, varint>::write(with_nul, buffer.begin());
+
+        shared_string_view_t view;
+        REQUIRE(view_serialize::read(buffer.view_begin(), buffer.view_end(),
+                                     view)
+                == buffer.view_end());
+        REQUIRE(view.view() == with_nul);
+        REQUIRE_THROWS_AS(
+            view_serialize::read(buffer.view_begin(), buffer.view_end() - 1,
+                                 view),
+            std::range_error);
+    }
+}
+
+TEST_CASE("delta encoding", "[serialize]")
+{
+    using bar_serialize = serialize<bar_t>;
+
+    bar_t baseline = {};
+    baseline.foo1 = { 1, 2, 3 };
+    baseline.foo2 = { 4, 5, 6 };
+    baseline.x = 1000;
+    baseline.vec = { 1, 2, 3 };
+    baseline.v = 7;
+
+    auto write_delta = [&](bar_t const& bar)
+    {
+        std::vector<char> buffer(bar_serialize::delta_size(bar, baseline));
+        REQUIRE(bar_serialize::write_delta(bar, baseline, buffer.begin())
+                == buffer.end());
+        return buffer;
+    };
+
+    SECTION("unchanged")
+    {
+        // Only the mask byte.
+        std::vector<char> const buffer = write_delta(baseline);
+        REQUIRE(buffer == std::vector<char>{ 0 });
+
+        bar_t bar = {};
+        REQUIRE(bar_serialize::read_delta(buffer.begin(), buffer.end(),
+                                          baseline, bar)
+                == buffer.end());
+        REQUIRE(bar == baseline);
+    }
+
+    SECTION("changed members")
+    {
+        bar_t bar = baseline;
+        bar.x = 2000;
+        bar.foo2.z = 60;
+        bar.vec.push_back(4);
+
+        // bar_t's mask, x, foo2's mask and foo2.z, then vec.
+        std::vector<char> const buffer = write_delta(bar);
+        REQUIRE(buffer.size() == 1 + 8 + (1 + 8) + (1 + 4 * 2));
+        REQUIRE(buffer[0] == 0b011010);
+        REQUIRE(buffer[9] == 0b100);
+
+        bar_t result = {};
+        REQUIRE(bar_serialize::read_delta(buffer.begin(), buffer.end(),
+                                          baseline, result)
+                == buffer.end());
+        REQUIRE(result == bar);
+
+        // The baseline may be the destination.
+        result = baseline;
+        bar_serialize::read_delta(buffer.begin(), buffer.end(), result,
+                                  result);
+        REQUIRE(result == bar);
+
+        REQUIRE_THROWS_AS(
+            bar_serialize::read_delta(buffer.begin(), buffer.end() - 1,
+                                      baseline, result),
+            std::range_error);
+    }
+
+    SECTION("unknown members")
+    {
+        // bar_t has 7 members, so the mask's high bit is invalid.
+        std::vector<char> const buffer = { char(0x80) };
+        bar_t bar;
+        REQUIRE_THROWS_AS(
+            bar_serialize::read_delta(buffer.begin(), buffer.end(),
+                                      baseline, bar),
+            std::overflow_error);
+    }
+}
+
+TEST_CASE("columnar", "[serialize]")
+{
+    using columnar_serialize = serialize<update_list_t, columnar>;
+    using row_serialize = serialize<update_list_t, varint>;
+
+    update_list_t updates;
+    for(object_id_t id = 1000; id != 1300; ++id)
+    {
+        int const i = id;
+        updates.push_back(
+            update_object_position_t{ id, { i % 40, i / 40 } });
+    }
+    updates.push_back(update_destroy_object_t{ 7 });
+    updates.push_back(update_create_player_t{ 3, 70000 });
+    updates.push_back(update_object_position_t{ 5, { -100, 100 } });
+
+    std::vector<char> const buffer
+        = write_to_vector<columnar_serialize>(updates);
+
+    // Sequential ids and neighbouring positions take a few bits per value.
+    REQUIRE(buffer.size() < row_serialize::size(updates) / 4);
+
+    update_list_t result;
+    REQUIRE(columnar_serialize::read(buffer.begin(), buffer.end(), result)
+            == buffer.end());
+    REQUIRE(write_to_vector<row_serialize>(result)
+            == write_to_vector<row_serialize>(updates));
+
+    REQUIRE_THROWS_AS(
+        columnar_serialize::read(buffer.begin(), buffer.end() - 1, result),
+        std::range_error);
+
+    // Appending keeps what's there, and leaves it as it was on errors.
+    result = updates;
+    REQUIRE(columnar_serialize::append(buffer.begin(), buffer.end(), result)
+            == buffer.end());
+    REQUIRE(result.size() == 2 * updates.size());
+    REQUIRE_THROWS_AS(
+        columnar_serialize::append(buffer.begin(), buffer.end() - 1, result),
+        std::range_error);
+    REQUIRE(result.size() == 2 * updates.size());
+    result.resize(updates.size());
+    REQUIRE(write_to_vector<row_serialize>(result)
+            == write_to_vector<row_serialize>(updates));
+
+    auto encode = [](std::initializer_list<std::int64_t> values)
+    {
+        std::vector<char> bytes;
+        for(std::int64_t v : values)
+        {
+            serialize<std::int64_t, zigzag_varint>::write(
+                v, std::back_inserter(bytes));
+        }
+        return bytes;
+    };
+
+    // A run longer than the list.
+    std::vector<char> bytes = { 1, 1, 2 };
+    REQUIRE_THROWS_AS(
+        columnar_serialize::read(bytes.cbegin(), bytes.cend(), result),
+        std::overflow_error);
+
+    // A player id which doesn't fit player_id_t.
+    bytes = { 1, 3, 1 };
+    for(char c : encode({ 70000, 1 }))
+        bytes.push_back(c);
+    REQUIRE_THROWS_AS(
+        columnar_serialize::read(bytes.cbegin(), bytes.cend(), result),
+        std::overflow_error);
+
+    // An unknown alternative.
+    bytes = { 1, 4, 1, 0 };
+    REQUIRE_THROWS_AS(
+        columnar_serialize::read(bytes.cbegin(), bytes.cend(), result),
+        std::out_of_range);
+
+    // Deltas which are 0 or more than 64 bits wide.
+    for(char width : { 0, 65 })
+    {
+        bytes = { 2, 1, 2, 14, width, 0 };
+        REQUIRE_THROWS_AS(
+            columnar_serialize::read(bytes.cbegin(), bytes.cend(), result),
+            std::overflow_error);
+    }
+
+    // A run of 2^40 destroys, which would take at least 2^40 bits.
+    bytes.clear();
+    auto out = std::back_inserter(bytes);
+    out = serialize<std::size_t, varint>::write(std::size_t(1) << 40, out);
+    out = serialize<std::uint8_t>::write(1, out);
+    out = serialize<std::size_t, varint>::write(std::size_t(1) << 40, out);
+    bytes.insert(bytes.end(), { 14, 1, 0, 0, 0, 0 });
+    REQUIRE_THROWS_AS(
+        columnar_serialize::read(bytes.cbegin(), bytes.cend(), result),
+        std::range_error);
+    REQUIRE(result.empty());
+
+    SECTION("alternatives without columns")
+    {
+        using empty_t = std::array<char, 0>;
+        using list_t = std::vector<eggs::variant<empty_t, std::uint8_t>>;
+        using list_serialize = serialize<list_t, columnar>;
+
+        list_t const list = { empty_t(), empty_t(), std::uint8_t(1),
+                              std::uint8_t(2), empty_t() };
+        std::vector<char> const buffer = write_to_vector<list_serialize>(list);
+        list_t list_result;
+        REQUIRE(list_serialize::read(buffer.begin(), buffer.end(),
+                                     list_result) == buffer.end());
+        REQUIRE(list_result == list);
+
+        // A run of 2^40 of them would take no input.
+        bytes.clear();
+        auto out = std::back_inserter(bytes);
+        out = serialize<std::size_t, varint>::write(std::size_t(1) << 40, out);
+        out = serialize<std::uint8_t>::write(0, out);
+        out = serialize<std::size_t, varint>::write(std::size_t(1) << 40, out);
+        REQUIRE_THROWS_AS(
+            list_serialize::read(bytes.cbegin(), bytes.cend(), list_result),
+            std::overflow_error);
+        REQUIRE(list_result.empty());
+    }
+}
+
+TEST_CASE("associative containers", "[serialize]")
+{
+    using boost::container::flat_map;
+    using boost::container::flat_set;
+
+    flat_map<std::uint32_t, int> storage;
+    for(std::uint32_t key = 0; key != 100; ++key)
+        storage[key * 7] = -int(key);
+
+    SECTION("flat_map")
+    {
+        using map_serialize = serialize<flat_map<std::uint32_t, int>>;
+        REQUIRE(map_serialize::size(storage) == 2 + 100 * 8);
+        REQUIRE(roundtrip<map_serialize>(storage) == storage);
+
+        std::vector<char> const buffer = write_to_vector<map_serialize>(
+            storage);
+        flat_map<std::uint32_t, int> result;
+        REQUIRE_THROWS_AS(
+            map_serialize::read(buffer.cbegin(), buffer.cend() - 1, result),
+            std::range_error);
+    }
+
+    SECTION("flat_set")
+    {
+        using set_serialize = serialize<flat_set<object_id_t>, varint>;
+        flat_set<object_id_t> const ids = { 3, 1, 4, 159, 26, 5 };
+        REQUIRE(set_serialize::size(ids) == 1 + 6 * 4);
+        REQUIRE(roundtrip<set_serialize>(ids) == ids);
+    }
+
+    SECTION("shared wire format")
+    {
+        using unordered_t = std::unordered_map<std::uint32_t, int>;
+        using ordered_t = std::map<std::uint32_t, int>;
+        using flat_t = flat_map<std::uint32_t, int>;
+
+        unordered_t const unordered(storage.begin(), storage.end());
+        std::vector<char> const buffer
+            = write_to_vector<serialize<unordered_t>>(unordered);
+
+        // Unsorted input is sorted when read into a flat container.
+        flat_t flat;
+        serialize<flat_t>::read(buffer.cbegin(), buffer.cend(), flat);
+        REQUIRE(flat == storage);
+
+        ordered_t ordered;
+        serialize<ordered_t>::read(buffer.cbegin(), buffer.cend(), ordered);
+        REQUIRE(flat_t(ordered.begin(), ordered.end()) == storage);
+
+        REQUIRE(roundtrip<serialize<unordered_t>>(unordered) == unordered);
+        REQUIRE(write_to_vector<serialize<ordered_t>>(ordered)
+                == write_to_vector<serialize<flat_t>>(flat));
+
+        std::unordered_set<std::uint16_t> const set = { 9, 8, 7 };
+        REQUIRE(roundtrip<serialize<std::unordered_set<std::uint16_t>>>(set)
+                == set);
+        std::set<std::string> const strings = { "a", "b" };
+        REQUIRE(roundtrip<serialize<std::set<std::string>>>(strings)
+                == strings);
+    }
+
+    SECTION("duplicate keys")
+    {
+        std::vector<char> const buffer = { 3, 0, 2, 1, 2 };
+        flat_set<std::uint8_t> set;
+        serialize<flat_set<std::uint8_t>>::read(buffer.cbegin(),
+                                                buffer.cend(), set);
+        REQUIRE(set == flat_set<std::uint8_t>{ 1, 2 });
+    }
+}
+
+namespace
+{
+    // Counts the allocations which reach the heap.
+    class counting_resource_t : public std::pmr::memory_resource
+    {
+    public:
+        std::size_t allocations = 0;
+
+    private:
+        void* do_allocate(std::size_t bytes, std::size_t align) override
+        {
+            ++allocations;
+            return std::pmr::new_delete_resource()->allocate(bytes, align);
+        }
+
+        void do_deallocate(void* p, std::size_t bytes,
+                           std::size_t align) override
+        {
+            std::pmr::new_delete_resource()->deallocate(p, bytes, align);
+        }
+
+        bool do_is_equal(memory_resource const& o) const noexcept override
+        {
+            return this == &o;
+        }
+    };
+}
+
+TEST_CASE("arena_t", "[serialize]")
+{
+    diff_t diff = { 5, {} };
+    for(object_id_t id = 0; id != 1000; ++id)
+        diff.updates.push_back(update_object_position_t{ id, { 1, 2 } });
+    std::vector<char> const buffer = write_to_vector<serialize<diff_t>>(diff);
+
+    counting_resource_t heap;
+    arena_t arena(64 * 1024, &heap);
+
+    for(int tick = 0; tick != 3; ++tick)
+    {
+        {
+            diff_t result = { 0, update_list_t(arena.resource()) };
+            serialize<diff_t>::read(buffer.begin(), buffer.end(), result);
+            REQUIRE(result.update_from == 5);
+            REQUIRE(result.updates.size() == 1000);
+            REQUIRE(result.updates.get_allocator().resource()
+                    == arena.resource());
+        }
+        arena.reset();
+    }
+
+    // Everything fit in the initial block, which is reused after resets.
+    REQUIRE(heap.allocations == 0);
+
+    // Larger messages grow the arena from the heap until it's reset.
+    arena_t small_arena(64, &heap);
+    {
+        diff_t result = { 0, update_list_t(small_arena.resource()) };
+        serialize<diff_t>::read(buffer.begin(), buffer.end(), result);
+        REQUIRE(result.updates.size() == 1000);
+    }
+    REQUIRE(heap.allocations > 0);
+    small_arena.reset();
+}
+
+TEST_CASE("max_size", "[serialize]")
+{
+    REQUIRE(serialize_max_size<serialize<foo_t>>::value
+            == serialize<foo_t>::const_size);
+    REQUIRE(serialize_max_size<serialize<std::uint32_t, varint>>::value == 5);
+    REQUIRE(serialize_max_size<serialize<std::uint8_t, varint>>::value == 2);
+
+    // Structs and variants of bounded members are bounded.
+    using create_serialize = serialize<update_create_object_t>;
+    REQUIRE(serialize_max_size<create_serialize>::value
+            == serialize_max_size<serialize<object_id_t, varint>>::value
+               + serialize<coord_t>::const_size);
+    REQUIRE(serialize_max_size<serialize<update_t>>::value
+            == serialize_max_size<create_serialize>::value + 1);
+
+    using array_t = std::array<std::uint16_t, 4>;
+    REQUIRE(serialize_max_size<serialize<array_t, varint>>::value == 12);
+
+    REQUIRE(serialize_fits<14, serialize<update_t>>::value);
+    REQUIRE(!serialize_fits<13, serialize<update_t>>::value);
+    REQUIRE(serialize_fits<17, serialize<update_t>, serialize<char>,
+                           serialize<std::uint16_t>>::value);
+    REQUIRE(!serialize_fits<1024, serialize<std::string>>::value);
+    REQUIRE(!serialize_fits<1024, serialize<std::vector<int>>>::value);
+    REQUIRE(!serialize_fits<1024, serialize<diff_t>>::value);
+
+    update_t const update = update_create_object_t{ 0xFFFFFFFF, { -1, -1 } };
+    std::array<char, serialize_max_size<serialize<update_t>>::value> buffer;
+    char* const end = serialize<update_t>::write(update, buffer.data());
+    REQUIRE(std::size_t(end - buffer.data()) == buffer.size());
+}
+
+TEST_CASE("bounded_sink_t", "[serialize]")
+{
+    foo_t const foo = { 122, -4302, 9038414 };
+    std::size_t const foo_size = serialize<foo_t>::const_size;
+
+    SECTION("try_write")
+    {
+        std::vector<char> buffer(foo_size * 2 + 4);
+        bounded_sink_t sink(buffer.data(), buffer.data() + buffer.size());
+        REQUIRE(sink.try_write<serialize<foo_t>>(foo));
+        REQUIRE(sink.try_write<serialize<foo_t>>(foo));
+        REQUIRE(sink.size() == foo_size * 2);
+        REQUIRE(!sink.truncated());
+
+        // A failed write leaves the sink's size alone.
+        REQUIRE(!sink.try_write<serialize<foo_t>>(foo));
+        REQUIRE(sink.truncated());
+        REQUIRE(sink.size() == foo_size * 2);
+        REQUIRE(sink.try_write<serialize<std::uint32_t>>(7u));
+        REQUIRE(sink.remaining() == 0);
+
+        foo_t result;
+        serialize<foo_t>::read(buffer.begin() + foo_size, buffer.end(),
+                               result);
+        REQUIRE(result == foo);
+    }
+
+    SECTION("unbounded")
+    {
+        std::string const str = "hello world";
+        std::vector<int> const vec(100, 5);
+        std::array<char, 16> buffer;
+        bounded_sink_t sink(buffer);
+
+        REQUIRE(!sink.try_write<serialize<std::vector<int>>>(vec));
+        REQUIRE(sink.size() == 0);
+        REQUIRE(sink.try_write<serialize<std::string>>(str));
+
+        std::string result;
+        serialize<std::string>::read(buffer.begin(), buffer.end(), result);
+        REQUIRE(result == str);
+    }
+
+    SECTION("try_write_list")
+    {
+        using list_serialize = serialize<update_list_t, columnar>;
+
+        update_list_t updates;
+        for(object_id_t id = 0; id != 100; ++id)
+        {
+            updates.push_back(update_destroy_object_t{ id * 1000 });
+            updates.push_back(update_object_position_t{ id, { 1, 2 } });
+        }
+        for(object_id_t id = 0; id != 1000; ++id)
+            updates.push_back(update_object_position_t{ id, { 1, 2 } });
+
+        // Split between runs at first, then inside the long run at the end.
+        update_list_t result;
+        std::array<char, 64> buffer;
+        for(auto it = updates.cbegin(); it != updates.cend();)
+        {
+            bounded_sink_t sink(buffer);
+            auto const rest = sink.try_write_list<list_serialize>(
+                it, updates.cend());
+            REQUIRE(rest != it);
+            REQUIRE(sink.truncated() == (rest != updates.cend()));
+
+            std::size_t const n = result.size();
+            auto const end = list_serialize::append(
+                buffer.data(), buffer.data() + buffer.size(), result);
+            REQUIRE(std::size_t(end - buffer.data()) == sink.size());
+            REQUIRE(result.size() - n == std::size_t(rest - it));
+
+            // Nothing more would have fit, but for the room reserved for
+            // the size of a list of all the remaining updates.
+            if(rest != updates.cend())
+            {
+                using size_serialize = serialize<std::size_t, varint>;
+                std::size_t const slack
+                    = size_serialize::size(updates.cend() - it)
+                      - size_serialize::size(rest - it);
+                REQUIRE(list_serialize::size(update_list_t(it, rest + 1))
+                        > buffer.size() - slack);
+            }
+            it = rest;
+        }
+        REQUIRE(write_to_vector<list_serialize>(result)
+                == write_to_vector<list_serialize>(updates));
+
+        std::array<char, 0> empty;
+        bounded_sink_t sink(empty);
+        REQUIRE_THROWS_AS(
+            sink.try_write_list<list_serialize>(updates.cbegin(),
+                                                updates.cend()),
+            std::length_error);
+    }
+}
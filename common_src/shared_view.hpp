@@ -0,0 +1,282 @@
+#ifndef SHARED_VIEW_HPP
+#define SHARED_VIEW_HPP
+
+// Views which deserialize by pointing into a shared_buffer_t rather than
+// copying out of it. Each view holds a copy of the buffer, keeping it alive.
+//
+// Views can only be read using the buffer's view_begin() and view_end():
+//
+//  struct foo
+//  {
+//      SERIALIZED_DATA
+//      (
+//          ((shared_string_view_t)             (name)  ())
+//          ((shared_int_span_t<std::uint32_t>) (ids)   ())
+//      )
+//  };
+//
+//  foo f;
+//  serialize<foo>::read(buffer.view_begin(), buffer.view_end(), f);
+//
+// The wire format is the same as std::string and std::vector, given the
+// same parameters, so a struct of views can read what a struct of owning
+// types wrote, and vice-versa.
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#include <boost/iterator/iterator_facade.hpp>
+
+#include "buffer.hpp"
+#include "serialize.hpp"
+
+namespace serialize_impl
+{
+    template<>
+    struct is_contiguous_bytes<shared_buffer_t::view_iterator>
+    : std::true_type {};
+
+    template<typename It>
+    void require_view_iterator()
+    {
+        static_assert(std::is_same<It, shared_buffer_t::view_iterator>::value,
+                      "views must be read using shared_buffer_t::view_begin");
+    }
+}
+
+// A string stored in a shared_buffer_t.
+class shared_string_view_t
+{
+public:
+    shared_string_view_t() = default;
+
+    shared_string_view_t(shared_buffer_t buffer, char const* data,
+                         std::size_t size)
+    : m_buffer(std::move(buffer))
+    , m_data(data)
+    , m_size(size)
+    {}
+
+    char const* data() const { return m_data; }
+    std::size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+
+    char const* begin() const { return m_data; }
+    char const* end() const { return m_data + m_size; }
+
+    std::string_view view() const { return std::string_view(m_data, m_size); }
+    operator std::string_view() const { return view(); }
+
+    std::string str() const { return std::string(m_data, m_size); }
+
+    shared_buffer_t const& buffer() const { return m_buffer; }
+
+private:
+    shared_buffer_t m_buffer;
+    char const* m_data = nullptr;
+    std::size_t m_size = 0;
+};
+
+inline bool operator==(shared_string_view_t const& a,
+                       shared_string_view_t const& b)
+{
+    return a.view() == b.view();
+}
+
+inline bool operator!=(shared_string_view_t const& a,
+                       shared_string_view_t const& b)
+{
+    return !(a == b);
+}
+
+// A list of integers stored in a shared_buffer_t.
+// Elements are serialized as Int, and decoded into T each time they're
+// accessed. Decoding throws std::overflow_error if the value doesn't fit T.
+template<typename T, typename Int = T>
+class shared_int_span_t
+{
+    using element = serialize<T, Int>;
+public:
+    using value_type = T;
+
+    class const_iterator
+    : public boost::iterator_facade<const_iterator, T const,
+                                    boost::random_access_traversal_tag, T>
+    {
+    public:
+        const_iterator() = default;
+        explicit const_iterator(char const* ptr) : m_ptr(ptr) {}
+    private:
+        friend class boost::iterator_core_access;
+
+        T dereference() const
+        {
+            T t;
+            element::read_unchecked(m_ptr, t);
+            return t;
+        }
+
+        bool equal(const_iterator const& o) const { return m_ptr == o.m_ptr; }
+        void increment() { m_ptr += element::const_size; }
+        void decrement() { m_ptr -= element::const_size; }
+        void advance(std::ptrdiff_t n) { m_ptr += n * element::const_size; }
+
+        std::ptrdiff_t distance_to(const_iterator const& o) const
+        {
+            return (o.m_ptr - m_ptr) / std::ptrdiff_t(element::const_size);
+        }
+
+        char const* m_ptr = nullptr;
+    };
+
+    shared_int_span_t() = default;
+
+    shared_int_span_t(shared_buffer_t buffer, char const* data,
+                      std::size_t size)
+    : m_buffer(std::move(buffer))
+    , m_data(data)
+    , m_size(size)
+    {}
+
+    std::size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+
+    T operator[](std::size_t i) const { return begin()[i]; }
+
+    T at(std::size_t i) const
+    {
+        if(i >= m_size)
+            throw std::out_of_range("shared_int_span_t::at");
+        return (*this)[i];
+    }
+
+    const_iterator begin() const { return const_iterator(m_data); }
+    const_iterator end() const { return begin() + m_size; }
+
+    // The elements in their serialized form.
+    char const* bytes() const { return m_data; }
+    std::size_t byte_size() const { return m_size * element::const_size; }
+
+    shared_buffer_t const& buffer() const { return m_buffer; }
+
+private:
+    shared_buffer_t m_buffer;
+    char const* m_data = nullptr;
+    std::size_t m_size = 0;
+};
+
+template<>
+struct serialize<shared_string_view_t, nul_terminated>
+{
+    using type = shared_string_view_t;
+
+    static constexpr std::size_t min_size = 1;
+
+    template<typename It>
+    static It read(It const begin, It const end, type& dest)
+    {
+        serialize_impl::require_view_iterator<It>();
+        It const last = serialize_impl::find_byte(begin, end, '\0');
+        if(last == end)
+            throw std::range_error("serialize::read range too small");
+        dest = type(begin.buffer(), begin.base(), last - begin);
+        return std::next(last);
+    }
+
+    template<typename It>
+    static It write(type const& src, It const dest)
+    {
+        It it = std::copy(src.begin(), src.end(), dest);
+        *it = '\0';
+        return ++it;
+    }
+
+    static std::size_t size(type const& t)
+    {
+        return t.size() + 1;
+    }
+};
+
+template<>
+struct serialize<shared_string_view_t>
+: serialize<shared_string_view_t, nul_terminated>
+{};
+
+template<typename SizeInt>
+struct serialize<shared_string_view_t, SizeInt>
+{
+    using type = shared_string_view_t;
+    using size_serialize = serialize<std::size_t, SizeInt>;
+
+    static constexpr std::size_t min_size
+        = serialize_impl::min_size<size_serialize>();
+
+    template<typename It>
+    static It read(It const begin, It const end, type& dest)
+    {
+        serialize_impl::require_view_iterator<It>();
+        std::size_t n;
+        It const it = size_serialize::read(begin, end, n);
+        serialize_impl::check_range(it, end, n);
+        dest = type(begin.buffer(), it.base(), n);
+        return it + n;
+    }
+
+    template<typename It>
+    static It write(type const& src, It const dest)
+    {
+        auto it = size_serialize::write(src.size(), dest);
+        return serialize_impl::write_bytes(src.data(), src.size(), it);
+    }
+
+    static std::size_t size(type const& t)
+    {
+        return size_serialize::size(t.size()) + t.size();
+    }
+};
+
+template<typename T, typename Int>
+struct serialize<shared_int_span_t<T, Int>>
+: serialize<shared_int_span_t<T, Int>, std::uint16_t>
+{};
+
+template<typename T, typename Int, typename SizeInt>
+struct serialize<shared_int_span_t<T, Int>, SizeInt>
+{
+    using type = shared_int_span_t<T, Int>;
+    using element = serialize<T, Int>;
+
+    static constexpr std::size_t min_size
+        = serialize_impl::min_size<serialize<std::size_t, SizeInt>>();
+
+    template<typename It>
+    static It read(It const begin, It const end, type& dest)
+    {
+        serialize_impl::require_view_iterator<It>();
+        std::size_t n;
+        It it = serialize<std::size_t, SizeInt>::read(begin, end, n);
+        serialize_impl::check_count(it, end, n, element::const_size);
+        dest = type(begin.buffer(), it.base(), n);
+        return it + n * element::const_size;
+    }
+
+    // The elements are already serialized, so they're copied as-is.
+    template<typename It>
+    static It write(type const& src, It const dest)
+    {
+        It it = serialize<std::size_t, SizeInt>::write(src.size(), dest);
+        return serialize_impl::write_bytes(src.bytes(), src.byte_size(), it);
+    }
+
+    static std::size_t size(type const& t)
+    {
+        return (serialize<std::size_t, SizeInt>::size(t.size())
+                + t.byte_size());
+    }
+};
+
+#endif
@@ -0,0 +1,150 @@
+#ifndef STREAM_PARSER_HPP
+#define STREAM_PARSER_HPP
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include "serialize.hpp"
+#include "type_index.hpp"
+
+// Incrementally parses a stream of (Header, Message) pairs, as sent over TCP.
+// Header must have 'opcode' and 'payload_size' members, and Message must be
+// a variant whose alternative is selected by 'opcode'.
+//
+// Bytes are received straight into the parser's buffer, in whatever amounts
+// the socket provides, and then complete messages are pulled out:
+//
+//  char* ptr = parser.prepare(n);
+//  parser.commit(socket.read_some(
+//      asio::buffer(ptr, parser.prepared_size())));
+//  while(parser.next(message))
+//      handle(message);
+//
+// One read can yield any number of messages, including zero.
+template<typename Header, typename Message>
+class stream_parser
+{
+public:
+    static constexpr std::size_t header_size = serialize<Header>::const_size;
+    static constexpr std::size_t default_max_payload_size = 1 << 16;
+    static constexpr std::size_t default_read_budget = 1 << 24;
+
+    // The most space 'prepare' adds for a pending message at once.
+    static constexpr std::size_t max_prepare_step = 1 << 16;
+
+    // Messages with payloads larger than 'max_payload_size' are rejected
+    // unread, and reading a message may allocate at most 'read_budget'
+    // bytes. See read_budget_t.
+    explicit stream_parser
+    ( std::size_t max_payload_size = default_max_payload_size
+    , std::size_t read_budget = default_read_budget)
+    : m_buffer()
+    , m_begin(0)
+    , m_end(0)
+    , m_needed(0)
+    , m_max_payload_size(max_payload_size)
+    , m_read_budget(read_budget)
+    {}
+
+    // Returns a pointer to space for at least 'n' bytes, or enough bytes to
+    // complete the pending message if that is larger, up to
+    // 'max_prepare_step' at a time. A header alone never grows the buffer
+    // to its payload size; the space follows the bytes actually received.
+    // Already received bytes are moved to the front of the buffer instead of
+    // growing it, when possible. Space taken by a large message is released
+    // once it has been parsed.
+    char* prepare(std::size_t n)
+    {
+        n = std::max(n, std::min(m_needed, max_prepare_step));
+        std::size_t const buffered = m_end - m_begin;
+        if(m_buffer.size() > max_prepare_step
+           && buffered + n <= max_prepare_step)
+        {
+            std::vector<char> buffer(max_prepare_step);
+            std::memcpy(buffer.data(), m_buffer.data() + m_begin, buffered);
+            m_buffer.swap(buffer);
+            m_begin = 0;
+            m_end = buffered;
+        }
+        else if(m_buffer.size() - m_end < n)
+        {
+            if(m_begin != 0)
+            {
+                std::memmove(m_buffer.data(), m_buffer.data() + m_begin,
+                             m_end - m_begin);
+                m_end -= m_begin;
+                m_begin = 0;
+            }
+            if(m_buffer.size() - m_end < n)
+                m_buffer.resize(m_end + n);
+        }
+        return m_buffer.data() + m_end;
+    }
+
+    // Returns the number of bytes available at the pointer returned by
+    // 'prepare'.
+    std::size_t prepared_size() const { return m_buffer.size() - m_end; }
+
+    // Marks 'n' bytes written to the pointer returned by 'prepare' as
+    // received.
+    void commit(std::size_t n)
+    {
+        if(n > prepared_size())
+            throw std::out_of_range("stream_parser::commit past prepare");
+        m_end += n;
+        m_needed = n >= m_needed ? 0 : m_needed - n;
+    }
+
+    // Parses the next complete message into 'dest'.
+    // Returns false if more bytes must be received first.
+    // Throws if the message is malformed, after which the stream is
+    // unusable.
+    bool next(Message& dest)
+    {
+        char const* const begin = m_buffer.data() + m_begin;
+        std::size_t const available = m_end - m_begin;
+        if(available < header_size)
+            return false;
+
+        Header header;
+        serialize<Header>::read(begin, begin + header_size, header);
+        if(header.payload_size > m_max_payload_size)
+            throw std::length_error("stream_parser payload too large");
+
+        std::size_t const message_size = header_size + header.payload_size;
+        if(available < message_size)
+        {
+            m_needed = message_size - available;
+            return false;
+        }
+
+        read_budget_t budget(m_read_budget);
+        using vs = variant_serializer<Message>;
+        runtime_type_indexer<Message> indexer;
+        indexer.template operator()<vs::template reader>(
+            header.opcode,
+            begin + header_size,
+            begin + message_size,
+            &dest);
+
+        m_begin += message_size;
+        if(m_begin == m_end)
+            m_begin = m_end = 0;
+        return true;
+    }
+
+    // Returns the number of received bytes not yet parsed.
+    std::size_t buffered() const { return m_end - m_begin; }
+
+private:
+    std::vector<char> m_buffer;
+    std::size_t m_begin;
+    std::size_t m_end;
+    std::size_t m_needed;
+    std::size_t m_max_payload_size;
+    std::size_t m_read_budget;
+};
+
+#endif
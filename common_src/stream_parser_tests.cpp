@@ -0,0 +1,154 @@
+#include "stream_parser.hpp"
+
+#include <catch/catch.hpp>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "net.hpp"
+
+using login_parser_t = stream_parser<cts_tcp_header_t, cts_tcp_message_t>;
+
+static void append_message(std::vector<char>& stream, std::string username)
+{
+    cts_tcp_message_t message = cts_tcp_login_t{ std::move(username) };
+    shared_buffer_t buffer = serialize_tcp_message<cts_tcp_header_t>(message);
+    stream.insert(stream.end(), buffer.begin(), buffer.end());
+}
+
+static std::vector<std::string> feed
+( login_parser_t& parser
+, std::vector<char> const& stream
+, std::size_t chunk_size)
+{
+    std::vector<std::string> usernames;
+    cts_tcp_message_t message;
+    for(std::size_t i = 0; i < stream.size(); i += chunk_size)
+    {
+        std::size_t const n = std::min(chunk_size, stream.size() - i);
+        std::memcpy(parser.prepare(n), &stream[i], n);
+        parser.commit(n);
+        while(parser.next(message))
+            usernames.push_back(message.target<cts_tcp_login_t>()->username);
+    }
+    return usernames;
+}
+
+TEST_CASE("stream_parser", "[stream_parser]")
+{
+    std::vector<char> stream;
+    std::vector<std::string> const usernames =
+        { "alice", "", "bob", std::string(5000, 'x') };
+    for(std::string const& username : usernames)
+        append_message(stream, username);
+
+    SECTION("one read")
+    {
+        login_parser_t parser;
+        REQUIRE(feed(parser, stream, stream.size()) == usernames);
+        REQUIRE(parser.buffered() == 0);
+    }
+
+    SECTION("partial reads")
+    {
+        for(std::size_t chunk_size : { 1, 3, 7, 64, 1000 })
+        {
+            login_parser_t parser;
+            REQUIRE(feed(parser, stream, chunk_size) == usernames);
+            REQUIRE(parser.buffered() == 0);
+        }
+    }
+
+    SECTION("pending message size")
+    {
+        login_parser_t parser;
+        std::size_t const n = login_parser_t::header_size;
+        std::memcpy(parser.prepare(n), stream.data(), n);
+        parser.commit(n);
+
+        cts_tcp_message_t message;
+        REQUIRE(!parser.next(message));
+
+        // Space is prepared for the rest of the message, but no more.
+        std::size_t const rest = serialize<cts_tcp_message_t, void>::size(
+            cts_tcp_message_t(cts_tcp_login_t{ "alice" }));
+        std::memcpy(parser.prepare(1), &stream[n], rest);
+        REQUIRE_THROWS_AS(parser.commit(rest + 1), std::out_of_range);
+        parser.commit(rest);
+        REQUIRE(parser.next(message));
+        REQUIRE(message.target<cts_tcp_login_t>()->username == "alice");
+    }
+
+    SECTION("large payload")
+    {
+        std::size_t const step = login_parser_t::max_prepare_step;
+        std::string const username(4 * step, 'x');
+        std::vector<char> large;
+        append_message(large, username);
+        login_parser_t parser(8 * step);
+
+        std::size_t const n = login_parser_t::header_size;
+        std::memcpy(parser.prepare(n), large.data(), n);
+        parser.commit(n);
+        cts_tcp_message_t message;
+        REQUIRE(!parser.next(message));
+
+        // Space is prepared a step at a time, not for the whole payload.
+        parser.prepare(1);
+        REQUIRE(parser.prepared_size() == step);
+
+        std::vector<char> const rest(large.begin() + n, large.end());
+        REQUIRE(feed(parser, rest, step / 3)
+                == std::vector<std::string>{ username });
+
+        // Once parsed, the message's space is released.
+        parser.prepare(1);
+        REQUIRE(parser.prepared_size() == step);
+    }
+
+    SECTION("payload too large")
+    {
+        login_parser_t parser(100);
+        REQUIRE_THROWS_AS(feed(parser, stream, stream.size()),
+                          std::length_error);
+    }
+
+    SECTION("bad opcode")
+    {
+        stream[0] = 10;
+        login_parser_t parser;
+        REQUIRE_THROWS_AS(feed(parser, stream, stream.size()),
+                          std::out_of_range);
+    }
+}
+
+TEST_CASE("tcp_message_buffers", "[stream_parser]")
+{
+    cts_tcp_message_t const message = cts_tcp_login_t{ "carol" };
+    tcp_body_t const body = serialize_tcp_body(message);
+
+    auto const buffers1 = tcp_message_buffers<cts_tcp_header_t>(body);
+    auto const buffers2 = tcp_message_buffers<cts_tcp_header_t>(body);
+
+    // Both sequences share the body without copying it.
+    REQUIRE(buffers1.segment(1).data() == body.buffer.data());
+    REQUIRE(buffers2.segment(1).data() == body.buffer.data());
+    REQUIRE(buffers1.segment(0).data() != buffers2.segment(0).data());
+
+    std::vector<char> stream;
+    for(boost::asio::const_buffer const& buffer : buffers1)
+    {
+        char const* data = static_cast<char const*>(buffer.data());
+        stream.insert(stream.end(), data, data + buffer.size());
+    }
+    REQUIRE(stream.size() == buffers1.size());
+
+    shared_buffer_t const single
+        = serialize_tcp_message<cts_tcp_header_t>(message);
+    REQUIRE(stream == std::vector<char>(single.begin(), single.end()));
+
+    login_parser_t parser;
+    REQUIRE(feed(parser, stream, stream.size())
+            == std::vector<std::string>{ "carol" });
+}
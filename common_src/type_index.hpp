@@ -1,6 +1,9 @@
 #ifndef TYPE_INDEX_HPP
 #define TYPE_INDEX_HPP
 
+#include <cstddef>
+#include <stdexcept>
+#include <tuple>
 #include <type_traits>
 #include <utility>
 
@@ -8,24 +11,30 @@
 
 namespace type_index_impl
 {
+    // Dispatches through a table of function pointers indexed by 'index',
+    // so every alternative costs the same single bounds check.
     template<template<typename> class FuncObj, typename... Ts>
-    struct runtime_type_index_;
-
-    template<template<typename> class FuncObj, typename T, typename... Ts>
-    struct runtime_type_index_<FuncObj, T, Ts...>
+    struct runtime_type_index_
     {
+        template<typename T, typename R, typename... Args>
+        static R call(Args&&... args)
+        {
+            FuncObj<T> func;
+            return func(std::forward<Args>(args)...);
+        }
+
         template<typename... Args>
         [[gnu::always_inline]]
         static auto func(std::size_t index, Args&&... args)
         {
-            if(index == 0)
-            {
-                FuncObj<T> func;
-                return func(std::forward<Args>(args)...);
-            }
-            return runtime_type_index_<FuncObj, Ts...>::func(
-                index - 1,
-                std::forward<Args>(args)...);
+            using first = std::tuple_element_t<0, std::tuple<Ts...>>;
+            using R = decltype(FuncObj<first>()(std::forward<Args>(args)...));
+            static constexpr R (*table[])(Args&&...) =
+                { &call<Ts, R, Args...>... };
+
+            if(index >= sizeof...(Ts))
+                throw std::out_of_range("runtime_type_index out of range");
+            return table[index](std::forward<Args>(args)...);
         }
     };
 
@@ -37,7 +46,7 @@ namespace type_index_impl
         static auto func(std::size_t index, Args&&... args)
         -> decltype(FuncObj<void>()(args...))
         {
-            throw std::out_of_range("runtime_type_index out of range ");
+            throw std::out_of_range("runtime_type_index out of range");
         }
     };
 }
@@ -0,0 +1,49 @@
+#include "type_index.hpp"
+
+#include <catch/catch.hpp>
+
+#include <cstddef>
+#include <stdexcept>
+#include <utility>
+
+#include <eggs/variant.hpp>
+
+namespace
+{
+    template<std::size_t I>
+    struct alt_t
+    {
+        static constexpr std::size_t value = I;
+    };
+
+    template<typename Seq>
+    struct make_variant;
+
+    template<std::size_t... Is>
+    struct make_variant<std::index_sequence<Is...>>
+    {
+        using type = eggs::variant<alt_t<Is>...>;
+    };
+
+    using variant64_t
+        = make_variant<std::make_index_sequence<64>>::type;
+
+    template<typename T>
+    struct value_of
+    {
+        std::size_t operator()(std::size_t x) const { return T::value + x; }
+    };
+}
+
+TEST_CASE("runtime_type_index", "[type_index]")
+{
+    runtime_type_indexer<variant64_t> indexer;
+    for(std::size_t i = 0; i != 64; ++i)
+        REQUIRE(indexer.operator()<value_of>(i, std::size_t(1000)) == i + 1000);
+    REQUIRE_THROWS_AS(indexer.operator()<value_of>(64, std::size_t(0)),
+                      std::out_of_range);
+
+    REQUIRE(runtime_type_index<value_of, alt_t<7>, alt_t<9>>(1,
+                                                             std::size_t(1))
+            == 10);
+}
@@ -2,7 +2,9 @@
 #define GAME_HPP
 
 #include <cstdint>
+#include <deque>
 #include <map>
+#include <memory_resource>
 #include <unordered_map>
 #include <unordered_set>
 #include <utility>
@@ -13,6 +15,7 @@
 #include <luajit-2.0/lua.hpp>
 #include <int2d/units.hpp>
 
+#include "columnar_serialize.hpp"
 #include "pool.hpp"
 #include "serialize.hpp"
 
@@ -97,10 +100,11 @@ struct update_destroy_object_t
 {
     SERIALIZED_DATA
     (
-        ((object_id_t) (object_id) ())
+        ((object_id_t) (object_id) (varint))
     )
 };
 
+// Fixed-width, like the client's, so that it has a const_size.
 struct update_object_position_t
 {
     SERIALIZED_DATA
@@ -110,4 +114,8 @@ struct update_object_position_t
     )
 };
 
+// Uses a polymorphic allocator so that a tick's updates can be placed
+// in an arena_t.
+using update_list_t = std::pmr::deque<update_t>;
+
 #endif
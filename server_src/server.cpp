@@ -15,6 +15,7 @@ server_t::server_t
                ip::udp::endpoint(ip::udp::v6(), std::stoi(port)))
 , m_udp_socket_strand(m_io_service)
 , m_udp_pool(new udp_pool_t())
+, m_udp_send_pool(new udp_send_pool_t())
 , m_tick_timer(io_service)
 {
     m_port = m_udp_socket.endpoint().port();
@@ -261,10 +262,16 @@ void server_t::handle_tick()
 
     // Create outgoing messages based on the history.
 
-    std::deque<shared_buffer_t> update_buffers;
+    // Each frame's updates are split into as many datagram bodies as
+    // they need, leaving room for the header in front of each.
+    using header_serialize = serialize<stc_udp_header_t, bit_packed>;
+    constexpr std::size_t body_size
+        = MAX_UDP_PAYLOAD - header_serialize::const_size;
+
+    std::deque<std::vector<shared_buffer_t>> update_buffers;
     for(frame_t const& frame : m_frame_history)
     {
-        std::deque<update_t> updates;
+        update_list_t updates(m_tick_arena.resource());
 
         for(auto const& pair : frame.updated)
         {
@@ -289,12 +296,30 @@ void server_t::handle_tick()
         for(object_id_t object_id : frame.destroyed)
             updates.push_back(update_destroy_object_t{ object_id });
 
-        using serialize_t = serialize<std::deque<update_t>>;
-        shared_buffer_t shared_buffer(serialize_t::size(updates));
-        serialize_t::write(updates, shared_buffer.begin());
-        
-        update_buffers.push_back(std::move(shared_buffer));
+        using list_serialize = serialize<update_list_t, columnar>;
+        std::vector<shared_buffer_t> bodies;
+        if(updates.empty())
+        {
+            // Still sent, as the header carries the time.
+            shared_buffer_t buffer(list_serialize::size(updates));
+            list_serialize::write(updates, buffer.begin());
+            bodies.push_back(std::move(buffer));
+        }
+
+        for(auto it = updates.cbegin(); it != updates.cend();)
+        {
+            shared_buffer_t buffer(body_size);
+            bounded_sink_t sink(buffer.begin(), buffer.end());
+            auto const rest
+                = sink.try_write_list<list_serialize>(it, updates.cend());
+            if(rest == it)
+                throw std::length_error("update too large for a datagram");
+            bodies.push_back(buffer.slice(0, sink.size()));
+            it = rest;
+        }
+        update_buffers.push_back(std::move(bodies));
     }
+    m_tick_arena.reset();
 
     // Send the messages.
 
@@ -310,25 +335,33 @@ void server_t::handle_tick()
         if(delta_time > delta_time_max)
             throw 0; // TODO
 
-        auto it = buffers.find(delta_time);
-        if(it == buffers.end())
+        // Each frame of history has its bodies, shared by every client
+        // with the same delta time. Only the header is per-client.
+        if(delta_time >= update_buffers.size())
         {
             // TODO
+            continue;
         }
 
-        std::vector<char>& buffer = it->second;
-
         stc_udp_header_t header;
         header.time = game_state.time;
         header.delta_time = delta_time;
         header.last_received_sequence = todo;
 
-        serialize<stc_udp_header_t>::write(header, buffer.begin());
-
-        udp::endpoint endpoint(pair.first, m_port);
-        connection.m_udp_socket.send_to(
-            asio::buffer(buffer.data(), buffer.size()),
-            endpoint);
+        ip::udp::endpoint endpoint(pair.first, m_port);
+        for(shared_buffer_t const& body : update_buffers[delta_time])
+        {
+            m_udp_socket_strand.post(
+                [this, endpoint, header, body](udp_socket_key_t key)
+                {
+                    udp_send_update(
+                        std::move(key),
+                        endpoint,
+                        header,
+                        body,
+                        [](udp_socket_key_t) {});
+                });
+        }
 
 
     }
@@ -354,6 +387,7 @@ server_t::connection_t::connection_t
 : m_server(server)
 , m_tcp_socket(std::move(tcp_socket))
 , m_tcp_socket_strand(io_service)
+, m_tcp_parser(max_tcp_payload_size, tcp_read_budget)
 {
     assert(&server.io_service(server_key()) == &io_service);
     assert(&m_tcp_socket.get_io_service() == &io_service);
@@ -406,29 +440,27 @@ void server_t::connection_t::handle_udp_receive
         std::printf("udp size: %lu\n", bytes_received);
 
         auto it = receiver.buffer.cbegin();
-        auto const end = receiver.buffer.cend() + bytes_received;
+        auto const end = receiver.buffer.cbegin() + bytes_received;
 
-        cts_udp_header_t header;
-        it = serialize<cts_udp_header_t>::read(it, end, header);
+        cts_udp_message_t message;
+        it = serialize<cts_udp_message_t, bit_packed>::read(it, end, message);
 
         /*
         if(connection.latest_received_sequence
-           .update(header.sequence_number) > header.sequence_number)
+           .update(message.header.sequence_number) 
+           > message.header.sequence_number)
         {
             // Discard the packet if we've seen a more recent one.
             return;
         }
         */
 
-        cts_udp_message_body_t body;
-        it = serialize<cts_udp_message_body_t>::read(it, end, body);
-
         std::printf("received udp\n");
 
         connection.m_server.m_udp_received.emplace_back(cts_udp_received_t
         {
             0, // TODO
-            { header, body }
+            message
         });
 
         // TODO: actually read shit.
@@ -18,11 +18,15 @@
 #include <boost/asio.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
 
+#include "arena.hpp"
+#include "bounded_sink.hpp"
 #include "buffer.hpp"
+#include "buffer_sequence.hpp"
 #include "game.hpp"
 #include "net.hpp"
 #include "pool.hpp"
 #include "safe_strand.hpp"
+#include "stream_parser.hpp"
 #include "threadsafe_map.hpp"
 #include "threadsafe_queue.hpp"
 
@@ -50,11 +54,24 @@ private:
         udp_buffer_t buffer;
     };
 
-    static constexpr std::size_t udp_pool_size = 32;
+    // Receivers are often freed by a different io thread than the one
+    // which allocated them, so each thread caches a magazine of them.
+    static constexpr std::size_t udp_pool_size = 128;
+    static constexpr std::size_t udp_magazine_size = 8;
     using shared_udp_receiver_t = shared_pooled_ptr<udp_receiver_t, 
-                                                    udp_pool_size>;
+                                                    udp_pool_size,
+                                                    udp_magazine_size>;
     using udp_pool_t = shared_udp_receiver_t::pool_type;
 
+    // Storage for outgoing messages with a small max_size, which would
+    // otherwise each allocate a shared_buffer_t.
+    static constexpr std::size_t udp_send_buffer_size = 64;
+    using udp_send_buffer_t = std::array<char, udp_send_buffer_size>;
+    using shared_udp_send_buffer_t = shared_pooled_ptr<udp_send_buffer_t,
+                                                       udp_pool_size,
+                                                       udp_magazine_size>;
+    using udp_send_pool_t = shared_udp_send_buffer_t::pool_type;
+
     using address_map_t = threadsafe_map<ip::address, 
                                          std::weak_ptr<connection_t>>;
 
@@ -81,11 +98,13 @@ private:
     void do_tcp_accept();
     void udp_receive(udp_socket_key_t key);
 
-    template<typename Handler>
+    // 'buffers' is a shared_buffer_sequence_t, which is kept alive until
+    // the send completes.
+    template<typename Buffers, typename Handler>
     void udp_send
     ( udp_socket_key_t key
     , ip::udp::endpoint endpoint
-    , shared_buffer_t shared_buffer
+    , Buffers buffers
     , Handler handler);
 
     template<typename Handler>
@@ -95,6 +114,16 @@ private:
     , stc_udp_message_t message
     , Handler handler);
 
+    // Sends 'header' followed by an already serialized body, which may be
+    // shared with other recipients.
+    template<typename Handler>
+    void udp_send_update
+    ( udp_socket_key_t key
+    , ip::udp::endpoint endpoint
+    , stc_udp_header_t header
+    , shared_buffer_t body
+    , Handler handler);
+
     void launch_tick();
     void handle_tick();
 private:
@@ -112,6 +141,7 @@ private:
     ip::udp::socket m_udp_socket;
     safe_strand<udp_socket_tag> m_udp_socket_strand;
     std::unique_ptr<udp_pool_t> m_udp_pool;
+    std::unique_ptr<udp_send_pool_t> m_udp_send_pool;
 
     address_map_t m_address_map;
 
@@ -121,22 +151,23 @@ private:
     std::unique_ptr<game_state_t> m_game_state;
 
     std::deque<frame_t> m_frame_history;
+
+    // Holds each tick's outgoing update lists until they're serialized.
+    arena_t m_tick_arena;
 };
 
-template<typename Handler>
+template<typename Buffers, typename Handler>
 void server_t::udp_send
 ( udp_socket_key_t key
 , ip::udp::endpoint endpoint
-, shared_buffer_t shared_buffer
+, Buffers buffers
 , Handler handler)
 {
-    auto asio_buffer = asio::buffer(shared_buffer.data(),
-                                    shared_buffer.size());
-    asio::async_write(
-        m_udp_socket,
-        asio_buffer,
+    m_udp_socket.async_send_to(
+        buffers,
+        endpoint,
         m_udp_socket_strand.wrap(
-            [shared_buffer = std::move(shared_buffer), handler]
+            [buffers, handler]
             (udp_socket_key_t key, error_code_t const& e, std::size_t) mutable
             {
                 if(!e)
@@ -156,13 +187,55 @@ void server_t::udp_send_message
 , stc_udp_message_t message
 , Handler handler)
 {
-    using message_serialize = serialize<stc_udp_message_t>;
-    shared_buffer_t buffer(message_serialize::size(message));
-    message_serialize::write(message, buffer.begin());
+    using header_serialize = serialize<stc_udp_header_t, bit_packed>;
+    using body_serialize = serialize<stc_udp_message_body_t, bit_packed>;
+    if constexpr(serialize_fits<udp_send_buffer_size,
+                                header_serialize, body_serialize>::value)
+    {
+        shared_udp_send_buffer_t storage
+            = make_shared_from_pool(*m_udp_send_pool);
+        char* it = header_serialize::write(message.header, storage->data());
+        it = body_serialize::write(message.body, it);
+        std::size_t const size = it - storage->data();
+        udp_send(
+            std::move(key),
+            std::move(endpoint),
+            pooled_buffer_t(std::move(storage), size),
+            handler);
+    }
+    else
+    {
+        buffer_sink_t sink(MAX_UDP_PAYLOAD);
+        auto it = header_serialize::write(message.header, sink.out());
+        body_serialize::write(message.body, it);
+        udp_send(
+            std::move(key),
+            std::move(endpoint),
+            shared_buffer_sequence_t<1>(sink.release()),
+            handler);
+    }
+}
+
+template<typename Handler>
+void server_t::udp_send_update
+( udp_socket_key_t key
+, ip::udp::endpoint endpoint
+, stc_udp_header_t header
+, shared_buffer_t body
+, Handler handler)
+{
+    using header_serialize = serialize<stc_udp_header_t, bit_packed>;
+    static_assert(header_serialize::const_size <= udp_send_buffer_size,
+                  "header doesn't fit udp_send_buffer_t");
+
+    shared_udp_send_buffer_t storage
+        = make_shared_from_pool(*m_udp_send_pool);
+    char* const it = header_serialize::write(header, storage->data());
+    std::size_t const size = it - storage->data();
     udp_send(
         std::move(key),
         std::move(endpoint),
-        std::move(buffer),
+        pooled_buffer_t(std::move(storage), size, std::move(body)),
         handler);
 }
         
@@ -222,11 +295,13 @@ private:
     ///////////////////////////////////
     // General send/receive functions
 
-    template<typename Handler>
+    // 'buffers' is a shared_buffer_sequence_t, which is kept alive until
+    // the send completes.
+    template<typename Buffers, typename Handler>
     static void tcp_send
     ( tcp_socket_key_t key
     , shared_connection_t shared_connection
-    , shared_buffer_t shared_buffer
+    , Buffers buffers
     , Handler handler);
 
     template<typename Handler>
@@ -236,26 +311,23 @@ private:
     , stc_tcp_message_t message
     , Handler handler);
 
+    // Sends a message body serialized with serialize_tcp_body, which may
+    // be shared with other connections.
     template<typename Handler>
-    static void tcp_read
+    static void tcp_send_message
     ( tcp_socket_key_t key
     , shared_connection_t shared_connection
-    , std::size_t bytes_to_read
+    , tcp_body_t const& body
     , Handler handler);
 
+    // Calls 'handler' with the next message, reading from the socket
+    // only when no complete message has been buffered already.
     template<typename Handler>
     static void tcp_read_message
     ( tcp_socket_key_t key
     , shared_connection_t shared_connection
     , Handler handler);
 
-    template<typename Handler>
-    static void tcp_read_message_body
-    ( tcp_socket_key_t key
-    , shared_connection_t shared_connection
-    , cts_tcp_header_t header
-    , Handler handler);
-
     ///////////////////////////////////
     // Startup messages (in sequential order)
 
@@ -276,24 +348,30 @@ private:
 
     asio::ip::tcp::socket m_tcp_socket;
     safe_strand<tcp_socket_tag> m_tcp_socket_strand;
+
+    // Clients only send small control messages over TCP, so anything
+    // large is hostile.
+    static constexpr std::size_t max_tcp_payload_size = 1 << 16;
+    static constexpr std::size_t tcp_read_budget = 1 << 16;
+
+    // Only accessed while holding a tcp_socket_key_t.
+    stream_parser<cts_tcp_header_t, cts_tcp_message_t> m_tcp_parser;
 };
 
-template<typename Handler>
+template<typename Buffers, typename Handler>
 void server_t::connection_t::tcp_send
 ( tcp_socket_key_t key
 , shared_connection_t shared_connection
-, shared_buffer_t shared_buffer
+, Buffers buffers
 , Handler handler)
 {
     connection_t& connection = *shared_connection;
-    auto asio_buffer = asio::buffer(shared_buffer.data(),
-                                    shared_buffer.size());
     asio::async_write(
         connection.m_tcp_socket,
-        asio_buffer,
+        buffers,
         connection.m_tcp_socket_strand.wrap(
             [ shared_connection = std::move(shared_connection)
-            , shared_buffer = std::move(shared_buffer)
+            , buffers
             , handler]
             (tcp_socket_key_t key, error_code_t const& e, std::size_t) mutable
             {
@@ -314,55 +392,75 @@ void server_t::connection_t::tcp_send_message
 , stc_tcp_message_t message
 , Handler handler)
 {
-    using header_serialize = serialize<stc_tcp_header_t>;
-    using message_serialize = serialize<stc_tcp_message_t, void>;
-
-    stc_tcp_header_t header = 
-    {
-        message.which(),
-        message_serialize::size(message),
-    };
-
-    shared_buffer_t shared_buffer(
-        header_serialize::size(header)
-        + message_serialize::size(message));
-
-    auto it = header_serialize::write(header, shared_buffer.begin());
-    it = message_serialize::write(message, it);
+    tcp_send_message(
+        std::move(key),
+        std::move(shared_connection),
+        serialize_tcp_body(message),
+        handler);
+}
 
+template<typename Handler>
+void server_t::connection_t::tcp_send_message
+( tcp_socket_key_t key
+, shared_connection_t shared_connection
+, tcp_body_t const& body
+, Handler handler)
+{
     tcp_send(
         std::move(key),
         std::move(shared_connection),
-        std::move(shared_buffer),
+        tcp_message_buffers<stc_tcp_header_t>(body),
         handler);
 }
 
 template<typename Handler>
-void server_t::connection_t::tcp_read
+void server_t::connection_t::tcp_read_message
 ( tcp_socket_key_t key
 , shared_connection_t shared_connection
-, std::size_t bytes
 , Handler handler)
 {
     connection_t& connection = *shared_connection;
-    shared_buffer_t shared_buffer(bytes);
-    auto asio_buffer = asio::buffer(shared_buffer.data(), 
-                                    shared_buffer.size());
-    asio::async_read(
-        connection.m_tcp_socket,
+
+    cts_tcp_message_t message;
+    bool parsed;
+    try
+    {
+        parsed = connection.m_tcp_parser.next(message);
+    }
+    catch(std::exception& e)
+    {
+        std::fprintf(stderr, "tcp_read error: %s\n", e.what());
+        return;
+    }
+
+    if(parsed)
+    {
+        handler(
+            std::move(key),
+            std::move(shared_connection),
+            std::move(message));
+        return;
+    }
+
+    constexpr std::size_t read_size = 4096;
+    char* const ptr = connection.m_tcp_parser.prepare(read_size);
+    auto asio_buffer = asio::buffer(
+        ptr,
+        connection.m_tcp_parser.prepared_size());
+    connection.m_tcp_socket.async_read_some(
         asio_buffer,
         connection.m_tcp_socket_strand.wrap(
-            [ shared_connection = std::move(shared_connection)
-            , shared_buffer = std::move(shared_buffer)
-            , handler]
-            (tcp_socket_key_t key, error_code_t const& e, std::size_t) mutable
+            [shared_connection = std::move(shared_connection), handler]
+            (tcp_socket_key_t key, error_code_t const& e, std::size_t bytes)
+            mutable
             {
                 if(!e)
                 {
-                    handler(
+                    shared_connection->m_tcp_parser.commit(bytes);
+                    tcp_read_message(
                         std::move(key),
                         std::move(shared_connection),
-                        std::move(shared_buffer));
+                        handler);
                 }
                 else
                 {
@@ -372,69 +470,4 @@ void server_t::connection_t::tcp_read
             }));
 }
 
-template<typename Handler>
-void server_t::connection_t::tcp_read_message
-( tcp_socket_key_t key
-, shared_connection_t shared_connection
-, Handler handler)
-{
-    // First read the header:
-    using header_serialize = serialize<cts_tcp_header_t>;
-    tcp_read(
-        std::move(key),
-        std::move(shared_connection),
-        header_serialize::const_size,
-        [handler]
-        (tcp_socket_key_t key
-        , shared_connection_t shared_connection
-        , shared_buffer_t shared_buffer)
-        {
-            cts_tcp_header_t header;
-            header_serialize::read(
-                shared_buffer.begin(),
-                shared_buffer.end(),
-                header);
-
-            // Then read the message body:
-            tcp_read_message_body(
-                std::move(key),
-                std::move(shared_connection),
-                std::move(header),
-                handler);
-        });
-}
-
-template<typename Handler>
-void server_t::connection_t::tcp_read_message_body
-( tcp_socket_key_t key
-, shared_connection_t shared_connection
-, cts_tcp_header_t header
-, Handler handler)
-{
-    tcp_read(
-        std::move(key),
-        std::move(shared_connection),
-        header.payload_size,
-        [header, handler]
-        (tcp_socket_key_t key
-        , shared_connection_t shared_connection
-        , shared_buffer_t shared_buffer)
-        {
-            cts_tcp_message_t message;
-            
-            using vs = variant_serializer<cts_tcp_message_t>;
-            runtime_type_indexer<cts_tcp_message_t> indexer;
-            indexer.operator()<vs::reader>(
-                header.opcode,
-                shared_buffer.begin(),
-                shared_buffer.end(),
-                &message);
-
-            handler(
-                std::move(key),
-                std::move(shared_connection),
-                std::move(message));
-        });
-}
-
 #endif